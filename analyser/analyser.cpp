@@ -1,6 +1,10 @@
 #include "analyser.h"
+#include "tokenizer/tokenizer.h"
 
+#include <algorithm>
 #include <climits>
+#include <functional>
+#include <sstream>
 #include <string>
 
 namespace miniplc0 {
@@ -59,20 +63,47 @@ namespace miniplc0 {
 
         _stage = true;
 
-        auto next = nextToken();
-        if(!next.has_value())
-            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNoMain);
-        unreadToken();
-        //{<function-definition>}
-        while(true)
+        //流式输出时函数体交给 _emit 之后就不再需要，释放它的空间
+        auto emit = [&]() {
+            if(_emit)
+            {
+                _emit(_function_num, _function_body.at(_function_num));
+                _function_body.at(_function_num) = FunctionBody();
+            }
+        };
+        //增量编译：函数依赖的全局变量和常量都由全局声明的源代码决定
+        if(_cache != nullptr)
         {
-            auto err = analyseFunctionDefinition();
-            if(err.has_value())
-                return err;
-            next = nextToken();
+            _cache_context = HashSeed;
+            HashValue(_cache_context, _optimize);
+            HashValue(_cache_context, _rotate_loops);
+            HashString(_cache_context, _source.data(), _source_functions.front().first);
+            for(std::size_t i = 0; i < _source_functions.size(); i++)
+            {
+                auto err = analyseCachedFunctionDefinition(i);
+                if(err.has_value())
+                    return err;
+                emit();
+            }
+        }
+        else
+        {
+            auto next = nextToken();
             if(!next.has_value())
-                break;
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNoMain);
             unreadToken();
+            //{<function-definition>}
+            while(true)
+            {
+                auto err = analyseFunctionDefinition();
+                if(err.has_value())
+                    return err;
+                emit();
+                next = nextToken();
+                if(!next.has_value())
+                    break;
+                unreadToken();
+            }
         }
         if(!_functions.isFunction("main"))
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNoMain);
@@ -135,6 +166,7 @@ namespace miniplc0 {
             //'='
             if(next.value().GetType() == TokenType::EQUAL)
             {
+                auto init_from = _start.size();
                 auto err = analyseExpression();
                 if(err.has_value())
                     return err;
@@ -144,7 +176,17 @@ namespace miniplc0 {
                 {
                     idx = getIndex(idtoken.GetValueString());
                     //该标识符的值已经通过表达式存在栈顶了，不需要分配内存
-                    if(isConst == 1)
+                    int32_t value;
+                    //编译期能求值的常量直接记下值，不占用全局变量的槽，初始化代码也删掉
+                    if(isConst == 1 && _optimize && evaluateConstant(init_from, value))
+                    {
+                        _start.resize(init_from);
+                        _global_uninitialized_vars.erase(idtoken.GetValueString());
+                        _global_consts.insert(std::pair<std::string, int32_t >(idtoken.GetValueString(), -1));
+                        _global_const_values.insert(std::pair<std::string, int32_t >(idtoken.GetValueString(), value));
+                        _nextTokenIndex--;
+                    }
+                    else if(isConst == 1)
                     {
                         _global_uninitialized_vars.erase(idtoken.GetValueString());
                         _global_consts.insert(std::pair<std::string, int32_t >(idtoken.GetValueString(), idx));
@@ -237,13 +279,11 @@ namespace miniplc0 {
         if(_functions.isFunction(funcname))
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrDuplicateDeclaration);
 
-        int32_t index = _constants._table.size();
+        //和之前的字符串字面量相同的函数名直接使用那个常量
+        int32_t index = stringConstant(funcname, type);
 
-        _constants.addConstantItem(funcname, type, index, funcname);
         _functions.addFunctionItem(funcname, type, index, 0);
-        if(_functions.getTableitem(funcname).GetIndex() == -1)
-            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNotDeclared);
-        _function_num = _functions.getTableitem(funcname).GetIndex();
+        _function_num = _function_body.size();
 
         _function_body.emplace_back(FunctionBody());
 
@@ -292,6 +332,107 @@ namespace miniplc0 {
         return {};
     }
 
+    //第 i 个函数定义按它的源代码和上下文查找缓存，命中时按缓存的结果更新符号表，不做词法分析；否则分析之后加入缓存。
+    //上下文是全局声明的源代码和之前每个函数的签名以及第一次赋值的全局变量，分析的结果只由它们和函数的源代码决定
+    std::optional<CompilationError> Analyser::analyseCachedFunctionDefinition(std::size_t i)
+    {
+        auto [begin, end] = _source_functions.at(i);
+        //函数之前的空白不影响结果
+        begin = _source.find_first_not_of(" \t\r\n", begin);
+        std::uint64_t key = _cache_context;
+        HashString(key, _source.data() + begin, end - begin);
+
+        CachedFunction function;
+        auto cached = _cache->Find(key);
+        if(cached != nullptr)
+        {
+            function = *cached;
+            int32_t index = stringConstant(function._name, function._type);
+            _functions.addFunctionItem(function._name, function._type, index, function._params);
+            _function_num = _function_body.size();
+            _function_body.emplace_back(FunctionBody());
+
+            std::vector<int32_t> strings;
+            for(auto& text : function._strings)
+                strings.push_back(stringConstant(text, "S"));
+            auto& code = _function_body.at(_function_num)._instruction;
+            code = function._instruction;
+            for(auto& it : code)
+                if(it.GetOperation() == Operation::LOADC)
+                    it.SetX(strings.at(it.GetX()));
+            for(auto& name : function._initialized)
+            {
+                int32_t dx = getIndex(name);
+                _global_uninitialized_vars.erase(name);
+                _global_vars.insert(std::pair<std::string, int32_t>(name, dx));
+            }
+            //第一个函数的 token 和全局声明一起生成，跳过它们
+            _offset = _tokens.size();
+        }
+        else
+        {
+            //第一个函数之后的函数在这里才做词法分析
+            if(i > 0 && !tokenizeSource(begin, end))
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidInput);
+            auto uninitialized = _global_uninitialized_vars;
+            _function_texts.clear();
+            auto err = analyseFunctionDefinition();
+            if(err.has_value())
+                return err;
+            //切开的范围中不止一个函数定义
+            if(_offset != _tokens.size())
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidFunctionDefinition);
+
+            auto& item = _functions._table.at(_function_num);
+            function = {item.GetName(), item.GetType(), item.GetParams(), _function_texts, {},
+                        _function_body.at(_function_num)._instruction};
+            for(auto& it : uninitialized)
+                if(!_global_uninitialized_vars.count(it.first))
+                    function._initialized.push_back(it.first);
+            for(auto& it : function._instruction)
+                if(it.GetOperation() == Operation::LOADC)
+                {
+                    auto text = _constants._table.at(it.GetX()).GetName();
+                    it.SetX(std::find(_function_texts.begin(), _function_texts.end(), text) - _function_texts.begin());
+                }
+            _cache->Add(key, function);
+        }
+
+        HashString(_cache_context, function._name.data(), function._name.size());
+        HashString(_cache_context, function._type.data(), function._type.size());
+        HashValue(_cache_context, function._params);
+        for(auto& name : function._initialized)
+            HashString(_cache_context, name.data(), name.size());
+        return {};
+    }
+
+    bool Analyser::SetSource(std::string source)
+    {
+        std::size_t prefix;
+        if(!SplitFunctions(source, prefix, _source_functions))
+            return false;
+        _source = std::move(source);
+        //全局声明之后要向前看三个 token，所以和第一个函数一起做词法分析
+        if(!tokenizeSource(0, _source_functions.front().second))
+        {
+            _source_functions.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool Analyser::tokenizeSource(std::size_t begin, std::size_t end)
+    {
+        std::istringstream input(_source.substr(begin, end - begin));
+        Tokenizer tokenizer(input);
+        auto p = tokenizer.AllTokens();
+        if(p.second.has_value())
+            return false;
+        _tokens = std::move(p.first);
+        _offset = 0;
+        return true;
+    }
+
     //<parameter-declaration>       ::= ['const']               <type-specifier>                <identifier>
     std::optional<CompilationError> Analyser::analyseParameterDeclaration() {
         int32_t isConst = 0;
@@ -377,6 +518,7 @@ namespace miniplc0 {
     //<statement> ::= '{' <statement-seq> '}'
     //                  |<condition-statement>
     //                  |<loop-statement>
+    //                  |<switch-statement>
     //                  |<jump-statement>
     //                  |<scan-statement>
     //                  |<print-statement>
@@ -411,6 +553,13 @@ namespace miniplc0 {
             if(err.has_value())
                 return err;
         }
+        else if(next.value().GetType() == TokenType::SWITCH)
+        {
+            unreadToken();
+            auto err = analyseSwitchStatement();
+            if(err.has_value())
+                return err;
+        }
         else if(next.value().GetType() == TokenType::RETURN)
         {
             unreadToken();
@@ -418,6 +567,17 @@ namespace miniplc0 {
             if(err.has_value())
                 return err;
         }
+        else if(next.value().GetType() == TokenType::BREAK)
+        {
+            //break 跳到最内层 switch 的结尾，结尾的位置在 switch 分析完后回填
+            if(_breaks.empty() || !_breaks.back().has_value())
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidBreak);
+            _breaks.back().value().push_back(_function_body.at(_function_num)._instruction.size());
+            _function_body.at(_function_num)._instruction.emplace_back(Operation::JMP, 0, 0);
+            next = nextToken();
+            if(!next.has_value() || next.value().GetType() != TokenType::SEMICOLON)
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrIncompleteStatement);
+        }
         else if(next.value().GetType() == TokenType::SCAN)
         {
             unreadToken();
@@ -530,6 +690,7 @@ namespace miniplc0 {
     {
         int32_t before_con;
         int32_t after_con;
+        int32_t before_body;
         int32_t setN;
 
 	    auto next = nextToken();
@@ -542,6 +703,9 @@ namespace miniplc0 {
         if(!next.has_value() || next.value().GetType() != TokenType::LEFT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
 
+        //记录condition的位置 循环旋转时需要再分析一次
+        auto con_offset = _offset;
+
         auto err = analyseCondition();
         if(err.has_value())
             return err;
@@ -552,13 +716,35 @@ namespace miniplc0 {
 
         //size-1为jcond
         after_con = _function_body.at(_function_num)._instruction.size() - 1;
+        before_body = _function_body.at(_function_num)._instruction.size();
 
+        _breaks.emplace_back();
         err = analyseStatement();
         if(err.has_value())
             return err;
+        _breaks.pop_back();
 
-        //循环体后无条件回到condition前 进行condition判断
-        _function_body.at(_function_num)._instruction.emplace_back(Operation::JMP, before_con, 0);
+        if(!_optimize || !_rotate_loops)
+        {
+            //循环体后无条件回到condition前 进行condition判断
+            _function_body.at(_function_num)._instruction.emplace_back(Operation::JMP, before_con, 0);
+        }
+        else
+        {
+            //循环旋转：循环体后再判断一次condition 为true时跳回循环体
+            //这样每次迭代只执行一次跳转
+            auto end_offset = _offset;
+            auto end_pos = _current_pos;
+            _offset = con_offset;
+            err = analyseCondition();
+            if(err.has_value())
+                return err;
+            _offset = end_offset;
+            _current_pos = end_pos;
+
+            auto& jcond = _function_body.at(_function_num)._instruction.back();
+            jcond = Instruction(invertJump(jcond.GetOperation()), before_body, 0);
+        }
 
         //回填conditon判断为false后 跳出循环体
         setN = _function_body.at(_function_num)._instruction.size();
@@ -567,6 +753,111 @@ namespace miniplc0 {
         return {};
     }
 
+    //<switch-statement>    ::= 'switch'    '('     <expression>    ')'     '{'     {<labeled-statement>}   '}'
+    //<labeled-statement>   ::= ('case' ['+'|'-'] <integer-literal> | 'default')    ':'     {<statement>}
+    std::optional<CompilationError> Analyser::analyseSwitchStatement()
+    {
+        auto next = nextToken();
+        if(!next.has_value() || next.value().GetType() != TokenType::SWITCH)
+            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWhattheFuck);
+
+        next = nextToken();
+        if(!next.has_value() || next.value().GetType() != TokenType::LEFT_BRACKET)
+            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
+
+        auto err = analyseExpression();
+        if(err.has_value())
+            return err;
+
+        next = nextToken();
+        if(!next.has_value() || next.value().GetType() != TokenType::RIGHT_BRACKET)
+            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
+        next = nextToken();
+        if(!next.has_value() || next.value().GetType() != TokenType::LEFT_BRACE)
+            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
+
+        //先生成各个分支的代码，记录每个标号的位置，最后把分派代码插入到分支之前
+        int32_t dispatch = _function_body.at(_function_num)._instruction.size();
+        std::vector<std::pair<int32_t, int32_t>> cases;
+        std::map<int32_t, bool> used;
+        int32_t otherwise = -1;
+
+        _breaks.emplace_back(std::vector<int32_t>());
+        next = nextToken();
+        while(next.has_value() && next.value().GetType() != TokenType::RIGHT_BRACE)
+        {
+            int32_t label = _function_body.at(_function_num)._instruction.size();
+            if(next.value().GetType() == TokenType::CASE)
+            {
+                int64_t sign = 1;
+                next = nextToken();
+                if(next.has_value() && (next.value().GetType() == TokenType::PLUS || next.value().GetType() == TokenType::MINUS))
+                {
+                    sign = next.value().GetType() == TokenType::MINUS ? -1 : 1;
+                    next = nextToken();
+                }
+                if(!next.has_value())
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrIncompleteStatement);
+                int64_t value;
+                if(next.value().GetType() == TokenType::DECIMAL_INTEGER)
+                    value = sign * std::stoll(next.value().GetValueString(), 0, 10);
+                else if(next.value().GetType() == TokenType::HEXDECIMAL_INTEGER)
+                    value = sign * std::stoll(next.value().GetValueString(), 0, 16);
+                else
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
+                if(value < INT_MIN || value > INT_MAX)
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrIntegerOverflow);
+                if(used.count(value))
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrDuplicateCase);
+                used[value] = true;
+                cases.emplace_back(value, label);
+            }
+            else if(next.value().GetType() == TokenType::DEFAULT)
+            {
+                if(otherwise >= 0)
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrDuplicateCase);
+                otherwise = label;
+            }
+            else
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
+
+            next = nextToken();
+            if(!next.has_value() || next.value().GetType() != TokenType::COLON)
+                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
+
+            next = nextToken();
+            while(next.has_value() && next.value().GetType() != TokenType::CASE
+                && next.value().GetType() != TokenType::DEFAULT && next.value().GetType() != TokenType::RIGHT_BRACE)
+            {
+                unreadToken();
+                err = analyseStatement();
+                if(err.has_value())
+                    return err;
+                next = nextToken();
+            }
+        }
+        if(!next.has_value())
+            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrIncompleteStatement);
+        auto breaks = _breaks.back().value();
+        _breaks.pop_back();
+
+        auto& code = _function_body.at(_function_num)._instruction;
+        int32_t end = code.size();
+        if(otherwise < 0)
+            otherwise = end;
+        auto table = switchDispatch(cases, otherwise, dispatch);
+        int32_t shift = table.size();
+
+        //分支中跳到分支内或结尾的跳转后移
+        for(int32_t i = dispatch; i < end; i++)
+            if(isJump(code.at(i).GetOperation()) && code.at(i).GetX() >= dispatch)
+                code.at(i).SetX(code.at(i).GetX() + shift);
+        code.insert(code.begin() + dispatch, table.begin(), table.end());
+        for(auto it : breaks)
+            code.at(it + shift).SetX(end + shift);
+        return {};
+    }
+
     //<jump-statement>      ::= <return-statement>
     //<return-statement>    ::= 'return'            [<expression>]  ';'
     std::optional<CompilationError> Analyser::analyseJumpStatement()
@@ -575,7 +866,7 @@ namespace miniplc0 {
         if(!next.has_value() || next.value().GetType() != TokenType::RETURN)
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWhattheFuck);
 
-        std::string type = _constants._table.at(_function_num).GetType();
+        std::string type = _functions._table.at(_function_num).GetType();
 
         if(type == "INT")
         {
@@ -664,7 +955,7 @@ namespace miniplc0 {
 
     //<print-statement> ::= 'print'         '('     [<printable-list>]      ')'     ';'
     //<printable-list>  ::= <printable>     {','    <printable>}
-    //<printable>       ::= <expression>
+    //<printable>       ::= <expression>|<string-literal>
     std::optional<CompilationError> Analyser::analysePrintStatement()
     {
         auto next = nextToken();
@@ -675,34 +966,49 @@ namespace miniplc0 {
         if(!next.has_value() || next.value().GetType() != TokenType::LEFT_BRACKET)
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrWrongToken);
 
-        auto err = analyseExpression();
-        if(err.has_value())
-            return err;
-        _function_body.at(_function_num)._instruction.emplace_back(Operation::IPRINT, 0, 0);
-
-        while(true)
+        auto& code = _function_body.at(_function_num)._instruction;
+        //还没有输出的字面量和分隔的空格，遇到表达式时才输出，相邻的合并成一次 SPRINT
+        std::string text;
+        next = nextToken();
+        if(!next.has_value())
+            return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidPrint);
+        if(next.value().GetType() != TokenType::RIGHT_BRACKET)
         {
-            next = nextToken();
-            if(!next.has_value())
-                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidPrint);
-            if(next.value().GetType() == TokenType::RIGHT_BRACKET)
-            {
-                _function_body.at(_function_num)._instruction.emplace_back(Operation::PRINTL, 0, 0);
-                break;
-            }
-            else if(next.value().GetType() == TokenType::COMMA)
+            unreadToken();
+            while(true)
             {
-                _function_body.at(_function_num)._instruction.emplace_back(Operation::BIPUSH, 32, 0);
-                _function_body.at(_function_num)._instruction.emplace_back(Operation::CPRINT, 0, 0);
-            }
-            else
-                return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidPrint);
+                next = nextToken();
+                if(!next.has_value())
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidPrint);
+                if(next.value().GetType() == TokenType::STRING_LITERAL)
+                    text += next.value().GetValueString();
+                else
+                {
+                    unreadToken();
+                    printText(code, text);
+                    text.clear();
+                    auto err = analyseExpression();
+                    if(err.has_value())
+                        return err;
+                    code.emplace_back(Operation::IPRINT, 0, 0);
+                }
 
-            err = analyseExpression();
-            if(err.has_value())
-                return err;
-            _function_body.at(_function_num)._instruction.emplace_back(Operation::IPRINT, 0, 0);
+                next = nextToken();
+                if(!next.has_value())
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidPrint);
+                if(next.value().GetType() == TokenType::RIGHT_BRACKET)
+                    break;
+                else if(next.value().GetType() == TokenType::COMMA)
+                    text += ' ';
+                else
+                    return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrInvalidPrint);
+            }
         }
+        //行尾的换行并入前面的字面量
+        if(text.empty())
+            code.emplace_back(Operation::PRINTL, 0, 0);
+        else
+            printText(code, text + '\n');
 
         next = nextToken();
         if(!next.has_value() || next.value().GetType() != TokenType::SEMICOLON)
@@ -1046,6 +1352,10 @@ namespace miniplc0 {
                         return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNotDeclared);
                     else if (isGlobalUninitializedVariable(next.value().GetValueString()))
                         return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNotInitialized);
+                    else if (_global_const_values.count(next.value().GetValueString())) {
+                        pushConstant(_start, _global_const_values[next.value().GetValueString()]);
+                        return {};
+                    }
                     //已声明&&已初始化
                     int32_t offset = getIndex(next.value().GetValueString());
                     _start.emplace_back(Operation::LOADA, 0, offset);
@@ -1060,6 +1370,10 @@ namespace miniplc0 {
                             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNotDeclared);
                         else if (isGlobalUninitializedVariable(next.value().GetValueString()))
                             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNotInitialized);
+                        else if (_global_const_values.count(next.value().GetValueString())) {
+                            pushConstant(_function_body.at(_function_num)._instruction, _global_const_values[next.value().GetValueString()]);
+                            return {};
+                        }
                         int32_t offset = getIndex(next.value().GetValueString());
                         _function_body.at(_function_num)._instruction.emplace_back(Operation::LOADA, 1, offset);
                         _function_body.at(_function_num)._instruction.emplace_back(Operation::ILOAD, 0, 0);
@@ -1095,7 +1409,7 @@ namespace miniplc0 {
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNeedFunctionIdentifier);
 
         type = _functions.getTableitem(next.value().GetValueString()).GetType();
-        int32_t index = _functions.getTableitem(next.value().GetValueString()).GetIndex();
+        int32_t index = _functions.getPosition(next.value().GetValueString());
         if(index == -1)
             return std::make_optional<CompilationError>(_current_pos, ErrorCode::ErrNotDeclaredFunction);
         int32_t needparams = _functions.getTableitem(next.value().GetValueString()).GetParams();
@@ -1173,6 +1487,163 @@ namespace miniplc0 {
 		_add(tk, _global_uninitialized_vars);
 	}
 
+	void Analyser::pushConstant(std::vector<Instruction>& code, int32_t value) {
+		if (value >= 0 && value <= 127)
+			code.emplace_back(Operation::BIPUSH, value, 0);
+		else
+			code.emplace_back(Operation::IPUSH, value, 0);
+	}
+
+	void Analyser::printText(std::vector<Instruction>& code, const std::string& text) {
+		if (text.size() == 1 && static_cast<unsigned char>(text.at(0)) <= 127) {
+			code.emplace_back(Operation::BIPUSH, text.at(0), 0);
+			code.emplace_back(Operation::CPRINT, 0, 0);
+			return;
+		}
+		//常量的长度是 u2，过长的文本分段输出
+		for (std::size_t begin = 0; begin < text.size(); begin += 0xffff) {
+			auto piece = text.substr(begin, 0xffff);
+			if (_cache != nullptr && std::find(_function_texts.begin(), _function_texts.end(), piece) == _function_texts.end())
+				_function_texts.push_back(piece);
+			code.emplace_back(Operation::LOADC, stringConstant(piece, "S"), 0);
+			code.emplace_back(Operation::SPRINT, 0, 0);
+		}
+	}
+
+	int32_t Analyser::stringConstant(const std::string& text, const std::string& type) {
+		if (!_strings.count(text)) {
+			_strings[text] = _constants._table.size();
+			_constants.addConstantItem(text, type, _constants._table.size(), text);
+		}
+		return _strings.at(text);
+	}
+
+	//值在栈顶，按值把 int32 的整个范围划分为若干区间，每个区间跳到同一个目标（分支或者 default），
+	//在区间上二分生成比较树，比较用 ICMP 避免减法溢出：
+	//  稠密的 case（连续的值）合并成少数几个区间，最外两层比较就是范围检查，之后只用 O(log n) 次比较确定分支；
+	//  稀疏的 case 之间隔着 default 的区间，只剩一个值时直接用一次相等比较。
+	//o0 没有间接跳转，不能生成真正的跳转表。
+	//每个目标有一段 POP; JMP 目标 的跳板，离开分派代码时弹出栈顶的值
+	std::vector<Instruction> Analyser::switchDispatch(std::vector<std::pair<int32_t, int32_t>> cases, int32_t otherwise, int32_t at) {
+		struct Interval {
+			int64_t lo;
+			int64_t hi;
+			int32_t target;
+		};
+		std::sort(cases.begin(), cases.end());
+		std::vector<Interval> intervals;
+		auto append = [&](int64_t lo, int64_t hi, int32_t target) {
+			if (!intervals.empty() && intervals.back().target == target)
+				intervals.back().hi = hi;
+			else
+				intervals.push_back({lo, hi, target});
+		};
+		int64_t next = INT_MIN;
+		for (auto& it : cases) {
+			if (it.first > next)
+				append(next, it.first - 1, otherwise);
+			append(it.first, it.first, it.second);
+			next = (int64_t)it.first + 1;
+		}
+		if (next <= INT_MAX)
+			append(next, INT_MAX, otherwise);
+
+		//跳板的下标在比较树生成完之后才知道，先记下跳到每个目标的指令
+		std::vector<Instruction> table;
+		std::map<int32_t, std::vector<int32_t>> exits;
+		auto jump = [&](Operation opr, int32_t target) {
+			exits[target].push_back(table.size());
+			table.emplace_back(opr, 0, 0);
+		};
+		std::function<void(size_t, size_t)> tree = [&](size_t from, size_t to) {
+			if (to - from == 1) {
+				jump(Operation::JMP, intervals.at(from).target);
+				return;
+			}
+			auto& middle = intervals.at(from + 1);
+			if (to - from == 3 && middle.lo == middle.hi && intervals.at(from).target == intervals.at(to - 1).target) {
+				table.emplace_back(Operation::DUP, 0, 0);
+				pushConstant(table, middle.lo);
+				table.emplace_back(Operation::ISUB, 0, 0);
+				jump(Operation::JE, middle.target);
+				jump(Operation::JMP, intervals.at(from).target);
+				return;
+			}
+			//值小于 intervals[split].lo 时在左半边
+			size_t split = (from + to) / 2;
+			table.emplace_back(Operation::DUP, 0, 0);
+			pushConstant(table, intervals.at(split).lo);
+			table.emplace_back(Operation::ICMP, 0, 0);
+			if (split - from == 1) {
+				jump(Operation::JL, intervals.at(from).target);
+				tree(split, to);
+				return;
+			}
+			int32_t less = table.size();
+			table.emplace_back(Operation::JL, 0, 0);
+			tree(split, to);
+			table.at(less).SetX(at + table.size());
+			tree(from, split);
+		};
+		tree(0, intervals.size());
+
+		//跳板之后是分支的代码，分支的下标都要加上分派代码的长度
+		int32_t size = table.size() + 2 * exits.size();
+		for (auto& it : exits) {
+			for (auto jmp : it.second)
+				table.at(jmp).SetX(at + table.size());
+			table.emplace_back(Operation::POP, 0, 0);
+			table.emplace_back(Operation::JMP, it.first + size, 0);
+		}
+		return table;
+	}
+
+	//只包含常量和四则运算的初始化代码，按 32 位补码求值；除以 0 等留到运行时
+	bool Analyser::evaluateConstant(std::size_t from, int32_t& value) {
+		std::vector<int32_t> stack;
+		for (auto i = from; i < _start.size(); i++) {
+			auto& it = _start.at(i);
+			auto opr = it.GetOperation();
+			if (opr == Operation::IPUSH || opr == Operation::BIPUSH) {
+				stack.push_back(it.GetX());
+				continue;
+			}
+			if (opr == Operation::INEG) {
+				if (stack.empty())
+					return false;
+				stack.back() = (int32_t)(0u - (uint32_t)stack.back());
+				continue;
+			}
+			if (stack.size() < 2)
+				return false;
+			auto rhs = (uint32_t)stack.back();
+			stack.pop_back();
+			auto lhs = (uint32_t)stack.back();
+			switch (opr) {
+				case Operation::IADD:
+					stack.back() = (int32_t)(lhs + rhs);
+					break;
+				case Operation::ISUB:
+					stack.back() = (int32_t)(lhs - rhs);
+					break;
+				case Operation::IMUL:
+					stack.back() = (int32_t)(lhs * rhs);
+					break;
+				case Operation::IDIV:
+					if (rhs == 0 || ((int32_t)rhs == -1 && (int32_t)lhs == INT32_MIN))
+						return false;
+					stack.back() = (int32_t)lhs / (int32_t)rhs;
+					break;
+				default:
+					return false;
+			}
+		}
+		if (stack.size() != 1)
+			return false;
+		value = stack.back();
+		return true;
+	}
+
 	int32_t Analyser::getIndex(const std::string& s) {
 		if (_global_uninitialized_vars.find(s) != _global_uninitialized_vars.end())
 			return _global_uninitialized_vars[s];
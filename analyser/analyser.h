@@ -4,8 +4,10 @@
 #include "instruction/instruction.h"
 #include "tokenizer/token.h"
 #include "symbols/symbols.h"
+#include "analyser/cache.h"
 
 #include <vector>
+#include <functional>
 #include <optional>
 #include <utility>
 #include <map>
@@ -22,15 +24,19 @@ namespace miniplc0 {
 		using int32_t = std::int32_t;
 		using FunctionBody = miniplc0::FunctionBody;
 	public:
-		Analyser(std::vector<Token> v)
+		Analyser(std::vector<Token> v, bool optimize = false, bool rotate_loops = true)
 			: _tokens(std::move(v)), _offset(0), _function_body({}), _current_pos(0, 0),
-			_global_uninitialized_vars({}), _global_vars({}), _global_consts({}), _nextTokenIndex(0), _stage(false), _function_num(0) {}
+			_global_uninitialized_vars({}), _global_vars({}), _global_consts({}), _global_const_values({}), _strings({}), _nextTokenIndex(0), _stage(false), _function_num(0),
+			_optimize(optimize), _rotate_loops(rotate_loops), _breaks({}), _cache(nullptr), _source(), _source_functions({}), _cache_context(0), _function_texts({}) {}
 		Analyser(Analyser&&) = delete;
 		Analyser(const Analyser&) = delete;
 		Analyser& operator=(Analyser) = delete;
 
 		// 唯一接口
 		std::pair<std::vector<FunctionBody>, std::optional<CompilationError>> Analyse();
+		// 增量编译时使用源程序而不是 token：按函数切开，只对全局声明和第一个函数做词法分析，
+		// 其余函数在没有命中缓存时才做。切分或者词法分析失败时返回 false，这时应当使用完整的 token
+		bool SetSource(std::string source);
 
 	private:
 		// 所有的递归子程序
@@ -41,6 +47,8 @@ namespace miniplc0 {
 
         std::optional<CompilationError> analyseFunctionDefinition();
 
+        std::optional<CompilationError> analyseCachedFunctionDefinition(std::size_t);
+
         std::optional<CompilationError> analyseParameterDeclaration();
 
         std::optional<CompilationError> analyseCompoundStatement();
@@ -53,6 +61,8 @@ namespace miniplc0 {
 
         std::optional<CompilationError> analyseLoopStatement();
 
+        std::optional<CompilationError> analyseSwitchStatement();
+
         std::optional<CompilationError> analyseJumpStatement();
 
         std::optional<CompilationError> analyseScanStatement();
@@ -101,6 +111,18 @@ namespace miniplc0 {
 		bool isGlobalConstant(const std::string&);
 		// 获得 {变量，常量} 在栈上的偏移
 		int32_t getIndex(const std::string&);
+		// 对启动代码中从 from 开始的常量初始化代码求值
+		bool evaluateConstant(std::size_t from, int32_t& value);
+		// 压入一个立即数
+		void pushConstant(std::vector<Instruction>&, int32_t);
+		// 字符串在常量表中的下标，不存在时以 type 为类型加入常量表
+		int32_t stringConstant(const std::string& text, const std::string& type);
+		// 把源程序中 [begin, end) 的 token 作为 _tokens，出错时返回 false
+		bool tokenizeSource(std::size_t begin, std::size_t end);
+		// 输出一段编译时确定的文本，单个字符用 CPRINT，否则用字符串常量
+		void printText(std::vector<Instruction>&, const std::string&);
+		// 生成 switch 的分派代码，cases 为 (值, 跳转目标)，跳转目标是分派代码插入之前的下标
+		std::vector<Instruction> switchDispatch(std::vector<std::pair<int32_t, int32_t>> cases, int32_t otherwise, int32_t at);
 
 		//函数表中查找
 		bool isFunction(const std::string&);
@@ -114,6 +136,10 @@ namespace miniplc0 {
         std::map<std::string, int32_t> _global_uninitialized_vars;
         std::map<std::string, int32_t> _global_vars;
         std::map<std::string, int32_t> _global_consts;
+        //编译期求出值的全局常量，不占用槽
+        std::map<std::string, int32_t> _global_const_values;
+        //函数名和字符串字面量在常量表中的下标，相同的内容只保存一次
+        std::map<std::string, int32_t> _strings;
 		// 下一个 token 在栈的偏移
 		int32_t _nextTokenIndex;
 
@@ -133,8 +159,29 @@ namespace miniplc0 {
         //在primaryexpression中function-call时不弹出 False
         bool popret;
 
-        //当前函数在函数体里的下标
+        //当前函数在函数体里的下标，也是在函数表中的下标
         int32_t _function_num;
 
+        //每个函数分析完之后调用，参数为函数的下标和函数体，之后函数体被清空；为空时保留所有的函数体
+        std::function<void(int32_t, FunctionBody&)> _emit;
+
+        //是否生成优化的代码（如循环旋转）
+        bool _optimize;
+        //优化时是否旋转循环，使用执行计数时由优化器决定
+        bool _rotate_loops;
+
+        //每层 switch 中 break 的 JMP 的下标，循环中不能 break，压入空值
+        std::vector<std::optional<std::vector<int32_t>>> _breaks;
+
+        //增量编译缓存，为空时不使用，这时 _source 和 _source_functions 无效
+        FunctionCache* _cache;
+        //增量编译的源程序和其中每个函数定义的范围
+        std::string _source;
+        std::vector<std::pair<std::size_t, std::size_t>> _source_functions;
+        //分析下一个函数之前的上下文的散列值
+        std::uint64_t _cache_context;
+        //当前函数按第一次使用的顺序用到的字符串常量
+        std::vector<std::string> _function_texts;
+
 	};
 }
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include "cache.h"
+
+#include <iterator>
+
+namespace miniplc0 {
+
+    static const std::uint32_t CacheMagic = 0x43304361;
+    // 分析器生成的代码改变时增加，旧的缓存全部失效
+    static const std::uint32_t CacheVersion = 1;
+
+    static void appendNumber(std::string& buffer, std::uint64_t value, int bytes) {
+        for (int k = bytes - 1; k >= 0; k--)
+            buffer.push_back((char)(std::uint8_t)(value >> (8 * k)));
+    }
+
+    static void appendString(std::string& buffer, const std::string& text) {
+        appendNumber(buffer, text.size(), 4);
+        buffer += text;
+    }
+
+    // 按大端序读缓存文件的内容，越界时返回 false
+    class CacheReader final {
+    public:
+        explicit CacheReader(const std::string& data) : _data(data), _position(0) {}
+
+        bool read(int bytes, std::uint64_t& value) {
+            if (_data.size() - _position < (std::size_t)bytes)
+                return false;
+            value = 0;
+            for (int k = 0; k < bytes; k++)
+                value = (value << 8) | (std::uint8_t)_data[_position++];
+            return true;
+        }
+
+        bool read(std::string& text) {
+            std::uint64_t size;
+            if (!read(4, size) || _data.size() - _position < size)
+                return false;
+            text.assign(_data, _position, size);
+            _position += size;
+            return true;
+        }
+
+    private:
+        const std::string& _data;
+        std::size_t _position;
+    };
+
+    static bool readFunction(CacheReader& reader, CachedFunction& function) {
+        std::uint64_t params, count;
+        if (!reader.read(function._name) || !reader.read(function._type) || !reader.read(4, params))
+            return false;
+        function._params = (std::int32_t)params;
+        for (auto list : {&function._strings, &function._initialized}) {
+            if (!reader.read(4, count))
+                return false;
+            list->clear();
+            for (std::uint64_t i = 0; i < count; i++) {
+                list->emplace_back();
+                if (!reader.read(list->back()))
+                    return false;
+            }
+        }
+        if (!reader.read(4, count))
+            return false;
+        function._instruction.clear();
+        for (std::uint64_t i = 0; i < count; i++) {
+            std::uint64_t operation, x, y;
+            if (!reader.read(1, operation) || !reader.read(4, x) || !reader.read(4, y))
+                return false;
+            function._instruction.emplace_back((Operation)operation, (std::int32_t)x, (std::int32_t)y);
+        }
+        return true;
+    }
+
+    bool FunctionCache::Load(std::istream& input) {
+        _loaded.clear();
+        std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        CacheReader reader(data);
+        std::uint64_t magic, version, count;
+        if (!reader.read(4, magic) || magic != CacheMagic || !reader.read(4, version) || version != CacheVersion
+            || !reader.read(4, count))
+            return false;
+        for (std::uint64_t i = 0; i < count; i++) {
+            std::uint64_t key;
+            CachedFunction function;
+            if (!reader.read(8, key) || !readFunction(reader, function)) {
+                _loaded.clear();
+                return false;
+            }
+            _loaded.emplace(key, std::move(function));
+        }
+        return true;
+    }
+
+    bool FunctionCache::Save(std::ostream& output) const {
+        std::string buffer;
+        appendNumber(buffer, CacheMagic, 4);
+        appendNumber(buffer, CacheVersion, 4);
+        appendNumber(buffer, _used.size(), 4);
+        for (auto& [key, function] : _used) {
+            appendNumber(buffer, key, 8);
+            appendString(buffer, function._name);
+            appendString(buffer, function._type);
+            appendNumber(buffer, (std::uint32_t)function._params, 4);
+            for (auto list : {&function._strings, &function._initialized}) {
+                appendNumber(buffer, list->size(), 4);
+                for (auto& it : *list)
+                    appendString(buffer, it);
+            }
+            appendNumber(buffer, function._instruction.size(), 4);
+            for (auto& it : function._instruction) {
+                appendNumber(buffer, (std::uint8_t)it.GetOperation(), 1);
+                appendNumber(buffer, (std::uint32_t)it.GetX(), 4);
+                appendNumber(buffer, (std::uint32_t)it.GetY(), 4);
+            }
+        }
+        return (bool)output.write(buffer.data(), buffer.size());
+    }
+
+    const CachedFunction* FunctionCache::Find(uint64_t key) {
+        auto used = _used.find(key);
+        if (used != _used.end())
+            return &used->second;
+        auto loaded = _loaded.find(key);
+        if (loaded == _loaded.end())
+            return nullptr;
+        _hits++;
+        return &_used.insert(_loaded.extract(loaded)).position->second;
+    }
+
+    void FunctionCache::Add(uint64_t key, CachedFunction function) {
+        _used.insert_or_assign(key, std::move(function));
+    }
+
+    void HashValue(std::uint64_t& hash, std::uint64_t value) {
+        for (int k = 0; k < 8; k++) {
+            hash ^= (std::uint8_t)(value >> (8 * k));
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    void HashString(std::uint64_t& hash, const char* text, std::size_t size) {
+        HashValue(hash, size);
+        for (std::size_t i = 0; i < size; i++) {
+            hash ^= (std::uint8_t)text[i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    bool SplitFunctions(const std::string& source, std::size_t& prefix, std::vector<std::pair<std::size_t, std::size_t>>& functions) {
+        functions.clear();
+        prefix = 0;
+        std::size_t n = source.size();
+        //花括号的层数，下一个函数定义开始的位置，上一个函数之后是否还有注释以外的内容
+        std::int64_t depth = 0;
+        std::size_t start = 0;
+        bool trailing = false;
+        for (std::size_t i = 0; i < n; i++) {
+            char ch = source[i];
+            char next = i + 1 < n ? source[i + 1] : '\0';
+            if (ch == '/' && next == '/') {
+                i = source.find('\n', i);
+                if (i == std::string::npos)
+                    break;
+                continue;
+            }
+            if (ch == '/' && next == '*') {
+                i = source.find("*/", i + 2);
+                if (i == std::string::npos)
+                    return false;
+                i++;
+                continue;
+            }
+            if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
+                continue;
+            trailing = true;
+            if (ch == '"') {
+                //字符串字面量不能跨行，转义的字符直接跳过
+                for (i++; i < n && source[i] != '"' && source[i] != '\n'; i++)
+                    if (source[i] == '\\')
+                        i++;
+                if (i >= n || source[i] != '"')
+                    return false;
+            }
+            else if (ch == ';' && depth == 0 && functions.empty())
+                start = i + 1;
+            else if (ch == '{') {
+                //全局声明中没有花括号，第一个函数从最后一个全局声明之后开始
+                if (depth == 0 && functions.empty())
+                    prefix = start;
+                depth++;
+            }
+            else if (ch == '}') {
+                if (--depth < 0)
+                    return false;
+                if (depth == 0) {
+                    functions.emplace_back(start, i + 1);
+                    start = i + 1;
+                    trailing = false;
+                }
+            }
+        }
+        return depth == 0 && !trailing && !functions.empty();
+    }
+}
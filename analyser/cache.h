@@ -0,0 +1,64 @@
+#pragma once
+
+#include "instruction/instruction.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <utility>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstddef> // for std::size_t
+
+namespace miniplc0 {
+
+    // 增量编译缓存中的一个函数：分析器为这个函数定义得到的全部结果
+    struct CachedFunction {
+        std::string _name;
+        std::string _type;
+        std::int32_t _params;
+        // 函数体中按第一次使用的顺序用到的字符串常量，_instruction 中 LOADC 的操作数是这里的下标
+        std::vector<std::string> _strings;
+        // 在这个函数中第一次被赋值的全局变量
+        std::vector<std::string> _initialized;
+        std::vector<Instruction> _instruction;
+    };
+
+    // 按函数的源代码和分析它之前的上下文的散列值保存分析器的结果，
+    // 源程序中没有改动的函数直接使用上一次的结果，不再做词法分析和语法分析
+    class FunctionCache final {
+    private:
+        using uint64_t = std::uint64_t;
+    public:
+        FunctionCache() : _loaded({}), _used({}), _hits(0) {}
+
+        // 读入缓存文件，格式不对时返回 false，缓存为空
+        bool Load(std::istream&);
+        // 只写回本次编译中用到的函数，删除的函数不会一直留在缓存里
+        bool Save(std::ostream&) const;
+        // 查找 key 对应的函数，找到时记为本次用到，没有时返回 nullptr
+        const CachedFunction* Find(uint64_t key);
+        void Add(uint64_t key, CachedFunction function);
+        // 本次编译中命中和新加入的函数个数
+        std::size_t Hits() const { return _hits; }
+        std::size_t Misses() const { return _used.size() - _hits; }
+        // 和读入的缓存文件相比是否有变化：有新加入的函数或者有没用到的函数
+        bool Changed() const { return Misses() > 0 || !_loaded.empty(); }
+
+    private:
+        std::map<uint64_t, CachedFunction> _loaded;
+        std::map<uint64_t, CachedFunction> _used;
+        std::size_t _hits;
+    };
+
+    // FNV-1a 散列，字符串先加入长度，拼接的结果不会相同
+    inline const std::uint64_t HashSeed = 0xcbf29ce484222325ULL;
+    void HashValue(std::uint64_t& hash, std::uint64_t value);
+    void HashString(std::uint64_t& hash, const char* text, std::size_t size);
+
+    // 不做词法分析，按花括号把源程序切成全局声明和之后的每个函数定义，跳过注释和字符串字面量。
+    // prefix 为全局声明的结束位置，functions 为每个函数定义的 [开始, 结束)，从上一个函数的右花括号之后开始。
+    // 花括号不配对、最后一个函数之后还有代码等情况返回 false，这时应当对整个源程序做词法分析
+    bool SplitFunctions(const std::string& source, std::size_t& prefix, std::vector<std::pair<std::size_t, std::size_t>>& functions);
+}
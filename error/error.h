@@ -50,7 +50,10 @@ namespace miniplc0 {
 		ErrIncompleteFunction,
 		ErrIncompleteStatement,
 		ErrParamsPlusFailed,
-		ErrMultiCommitNotMatch
+		ErrMultiCommitNotMatch,
+		ErrDuplicateCase,
+		ErrInvalidBreak,
+		ErrInvalidStringLiteral
 	};
 
 	class CompilationError final{
@@ -110,6 +110,15 @@ namespace fmt {
                     break;
                 case miniplc0::ErrMultiCommitNotMatch:
                     name = "Need */ to match MultiCommit.";
+                    break;
+                case miniplc0::ErrDuplicateCase:
+                    name = "The case label has been used in this switch.";
+                    break;
+                case miniplc0::ErrInvalidBreak:
+                    name = "The break statement must be inside a switch.";
+                    break;
+                case miniplc0::ErrInvalidStringLiteral:
+                    name = "The string literal is not closed or has an invalid escape sequence.";
                     break;
 			}
 			return format_to(ctx.out(), name);
@@ -259,6 +268,9 @@ namespace fmt {
                 case miniplc0::SEMICOLON:
                     name = "Semicolon";
                     break;
+                case miniplc0::COLON:
+                    name = "Colon";
+                    break;
                 case miniplc0::LEFT_BRACKET:
                     name = "LeftBracket";
                     break;
@@ -273,6 +285,9 @@ namespace fmt {
                     break;
                 case miniplc0::COMMIT:
                     name = "Commit";
+                    break;
+                case miniplc0::STRING_LITERAL:
+                    name = "StringLiteral";
                     break;
 			}
 			return format_to(ctx.out(), name);
@@ -467,6 +482,39 @@ namespace fmt {
 			    case miniplc0::CSCAN:
 			        name = "cscan";
 			        break;
+			    case miniplc0::ILOADL:
+			        name = "iloadl";
+			        break;
+			    case miniplc0::ILOADG:
+			        name = "iloadg";
+			        break;
+			    case miniplc0::ISTOREL:
+			        name = "istorel";
+			        break;
+			    case miniplc0::ISTOREG:
+			        name = "istoreg";
+			        break;
+			    case miniplc0::IADDI:
+			        name = "iaddi";
+			        break;
+			    case miniplc0::IJE:
+			        name = "ije";
+			        break;
+			    case miniplc0::IJNE:
+			        name = "ijne";
+			        break;
+			    case miniplc0::IJL:
+			        name = "ijl";
+			        break;
+			    case miniplc0::IJGE:
+			        name = "ijge";
+			        break;
+			    case miniplc0::IJG:
+			        name = "ijg";
+			        break;
+			    case miniplc0::IJLE:
+			        name = "ijle";
+			        break;
 			}
 			return format_to(ctx.out(), name);
 		}
@@ -540,6 +588,17 @@ namespace fmt {
 			    case miniplc0::JG:
 			    case miniplc0::JLE:
 			    case miniplc0::CALL:
+			    case miniplc0::ILOADL:
+			    case miniplc0::ILOADG:
+			    case miniplc0::ISTOREL:
+			    case miniplc0::ISTOREG:
+			    case miniplc0::IADDI:
+			    case miniplc0::IJE:
+			    case miniplc0::IJNE:
+			    case miniplc0::IJL:
+			    case miniplc0::IJGE:
+			    case miniplc0::IJG:
+			    case miniplc0::IJLE:
 				    return format_to(ctx.out(), "{} {}", p.GetOperation(), p.GetX());
 			    case miniplc0::LOADA:
 			        return format_to(ctx.out(), "{} {},{}", p.GetOperation(), p.GetX(), p.GetY());
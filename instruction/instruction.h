@@ -1,6 +1,9 @@
 #pragma once
 
+#include "error/error.h"
+
 #include <cstdint>
+#include <cstddef>
 #include <utility>
 
 namespace miniplc0 {
@@ -64,7 +67,23 @@ namespace miniplc0 {
         PRINTL = 0xaf,
         ISCAN = 0xb0,
         DSCAN = 0xb1,
-        CSCAN = 0xb2
+        CSCAN = 0xb2,
+        // 以下为 o0 第 2 版的超级指令
+        // LOADA 0,x; ILOAD / LOADA 1,x; ILOAD
+        ILOADL = 0xc0,
+        ILOADG = 0xc1,
+        // LOADA 0,x; <值>; ISTORE / LOADA 1,x; <值>; ISTORE，地址不再入栈
+        ISTOREL = 0xc2,
+        ISTOREG = 0xc3,
+        // BIPUSH x; IADD
+        IADDI = 0xc4,
+        // ISUB; Jcc x，差按 32 位补码计算
+        IJE = 0xc8,
+        IJNE = 0xc9,
+        IJL = 0xca,
+        IJGE = 0xcb,
+        IJG = 0xcc,
+        IJLE = 0xcd
 	};
 	
 	class Instruction final {
@@ -99,4 +118,165 @@ namespace miniplc0 {
 		swap(lhs._x, rhs._x);
 		swap(lhs._y, rhs._y);
 	}
+
+	// 条件跳转指令
+	inline bool isConditionalJump(Operation opr) {
+		switch (opr) {
+			case Operation::JE:
+			case Operation::JNE:
+			case Operation::JL:
+			case Operation::JGE:
+			case Operation::JG:
+			case Operation::JLE:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// 比较并跳转的超级指令
+	inline bool isCompareJump(Operation opr) {
+		switch (opr) {
+			case Operation::IJE:
+			case Operation::IJNE:
+			case Operation::IJL:
+			case Operation::IJGE:
+			case Operation::IJG:
+			case Operation::IJLE:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// 跳转指令
+	inline bool isJump(Operation opr) {
+		return opr == Operation::JMP || isConditionalJump(opr) || isCompareJump(opr);
+	}
+
+	// 只在 o0 第 2 版中出现的超级指令
+	inline bool isSuperinstruction(Operation opr) {
+		switch (opr) {
+			case Operation::ILOADL:
+			case Operation::ILOADG:
+			case Operation::ISTOREL:
+			case Operation::ISTOREG:
+			case Operation::IADDI:
+				return true;
+			default:
+				return isCompareJump(opr);
+		}
+	}
+
+	// 返回指令
+	inline bool isReturn(Operation opr) {
+		return opr == Operation::RET || opr == Operation::IRET;
+	}
+
+	// 只涉及 int 的指令，也就是本编译器会生成的指令
+	inline bool isIntegerOperation(Operation opr) {
+		switch (opr) {
+			case Operation::NOP:
+			case Operation::BIPUSH:
+			case Operation::IPUSH:
+			case Operation::POP:
+			case Operation::POP2:
+			case Operation::POPN:
+			case Operation::DUP:
+			case Operation::DUP2:
+			case Operation::LOADC:
+			case Operation::LOADA:
+			case Operation::SNEW:
+			case Operation::ILOAD:
+			case Operation::ISTORE:
+			case Operation::IADD:
+			case Operation::ISUB:
+			case Operation::IMUL:
+			case Operation::IDIV:
+			case Operation::INEG:
+			case Operation::ICMP:
+			case Operation::JMP:
+			case Operation::JE:
+			case Operation::JNE:
+			case Operation::JL:
+			case Operation::JGE:
+			case Operation::JG:
+			case Operation::JLE:
+			case Operation::CALL:
+			case Operation::RET:
+			case Operation::IRET:
+			case Operation::IPRINT:
+			case Operation::CPRINT:
+			case Operation::SPRINT:
+			case Operation::PRINTL:
+			case Operation::ISCAN:
+				return true;
+			default:
+				return isSuperinstruction(opr);
+		}
+	}
+
+	// 条件取反后的跳转指令
+	inline Operation invertJump(Operation opr) {
+		switch (opr) {
+			case Operation::JE:
+				return Operation::JNE;
+			case Operation::JNE:
+				return Operation::JE;
+			case Operation::JL:
+				return Operation::JGE;
+			case Operation::JGE:
+				return Operation::JL;
+			case Operation::JG:
+				return Operation::JLE;
+			case Operation::JLE:
+				return Operation::JG;
+			default:
+				DieAndPrint("only conditional jump can be inverted.");
+				return opr;
+		}
+	}
+
+	// 指令两个操作数编码后的字节数，没有的操作数为 0
+	inline std::pair<std::size_t, std::size_t> operandSizes(Operation opr) {
+		switch (opr) {
+			case Operation::BIPUSH:
+			case Operation::IADDI:
+				return {1, 0};
+			case Operation::LOADC:
+			case Operation::JMP:
+			case Operation::JE:
+			case Operation::JNE:
+			case Operation::JL:
+			case Operation::JGE:
+			case Operation::JG:
+			case Operation::JLE:
+			case Operation::CALL:
+			case Operation::ILOADL:
+			case Operation::ILOADG:
+			case Operation::ISTOREL:
+			case Operation::ISTOREG:
+			case Operation::IJE:
+			case Operation::IJNE:
+			case Operation::IJL:
+			case Operation::IJGE:
+			case Operation::IJG:
+			case Operation::IJLE:
+				return {2, 0};
+			case Operation::IPUSH:
+			case Operation::POPN:
+			case Operation::SNEW:
+				return {4, 0};
+			case Operation::LOADA:
+				return {2, 4};
+			default:
+				return {0, 0};
+		}
+	}
+
+	// 指令编码后的字节数
+	inline std::size_t instructionSize(const Instruction& instruction) {
+		auto sizes = operandSizes(instruction.GetOperation());
+		return 1 + sizes.first + sizes.second;
+	}
 }
\ No newline at end of file
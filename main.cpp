@@ -3,10 +3,19 @@
 
 #include "tokenizer/tokenizer.h"
 #include "analyser/analyser.h"
+#include "optimizer/optimizer.h"
 #include "fmts.hpp"
 
+#include "vm/vm.h"
+
 #include <iostream>
+#include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cstdio>
+#include <iterator>
+#include <memory>
 
 // i2,i3,i4的内容，以大端序（big-endian）写入文件
 typedef int8_t  i1;
@@ -20,75 +29,48 @@ typedef uint16_t u2;
 typedef uint32_t u4;
 typedef uint64_t u8;
 
-u2 transToInt16(u2 x){ return (x >> 8) | (x << 8); }
-
-u4 transToInt32(u4 x){ return ((x & 0x000000FF) << 24) | ((x & 0x0000FF00) << 8) | ((x & 0x00FF0000) >> 8) | ((x & 0xFF000000) >> 24); }
+// 把 value 的低 bytes 个字节按大端序追加到 buffer
+void appendBigEndian(std::string& buffer, u4 value, int bytes) {
+    for (int k = bytes - 1; k >= 0; k--)
+        buffer.push_back((char)(u1)(value >> (8 * k)));
+}
 
-void instructionBinaryOutput(miniplc0::Instruction instruction, std::ostream& output){
-    int xLeng = 0;
-    int yLeng = 0;
-    switch(instruction.GetOperation())
-    {
-        case miniplc0::BIPUSH:
-            xLeng = 1;
-            break;
-        case miniplc0::LOADC:
-        case miniplc0::JMP:
-        case miniplc0::JE:
-        case miniplc0::JNE:
-        case miniplc0::JL:
-        case miniplc0::JGE:
-        case miniplc0::JG:
-        case miniplc0::JLE:
-        case miniplc0::CALL:
-            xLeng = 2;
-            break;
-        case miniplc0::IPUSH:
-        case miniplc0::POPN:
-        case miniplc0::SNEW:
-            xLeng = 4;
-            break;
-        case miniplc0::LOADA:
-            xLeng = 2;
-            yLeng = 4;
-            break;
-        default:
-            break;
-    }
-    u1 opcode = (u1)instruction.GetOperation();
-    u4 operand1 = (u4)instruction.GetX();
-    u4 operand2 = (u4)instruction.GetY();
+// 追加一条指令的编码：操作码之后是 operandSizes 给出宽度的操作数
+void appendInstruction(std::string& buffer, const miniplc0::Instruction& instruction) {
+    auto sizes = miniplc0::operandSizes(instruction.GetOperation());
+    buffer.push_back((char)(u1)instruction.GetOperation());
+    appendBigEndian(buffer, (u4)instruction.GetX(), sizes.first);
+    appendBigEndian(buffer, (u4)instruction.GetY(), sizes.second);
+}
 
-    output.write((char*)&opcode, sizeof(u1));
+// 追加一段代码：u2 指令数之后是每条指令
+void appendCode(std::string& buffer, const std::vector<miniplc0::Instruction>& code) {
+    buffer.reserve(buffer.size() + 2 + code.size() * 5);
+    appendBigEndian(buffer, (u4)code.size(), 2);
+    for (auto& it : code)
+        appendInstruction(buffer, it);
+}
 
-    if(xLeng == 0)
-        return;
-    else if(xLeng == 1)
-    {
-        u1 op = (u1)operand1;
-        output.write((char*)&op, sizeof(u1));
-    }
-    else if(xLeng == 2 && yLeng == 0)
-    {
-        u2 op = transToInt16((u2)operand1);
-        output.write((char*)&op, sizeof(u2));
-    }
-    else if(xLeng == 4)
-    {
-        u4 op = transToInt32((u4)operand1);
-        output.write((char*)&op, sizeof(u4));
-    }
-    else
-    {
-        u2 op1 = transToInt16((u2)operand1);
-        u4 op2 = transToInt32((u4)operand2);
-        output.write((char*)&op1, sizeof(u2));
-        output.write((char*)&op2, sizeof(u4));
+// 文本格式中字符串常量的转义，和字面量支持的转义相同
+std::string escapeString(const std::string& text) {
+    std::string result;
+    for (char ch : text) {
+        switch (ch) {
+            case '\\': result += "\\\\"; break;
+            case '"': result += "\\\""; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if (miniplc0::isprint(ch))
+                    result += ch;
+                else
+                    result += fmt::format("\\x{:02x}", static_cast<unsigned char>(ch));
+        }
     }
-    return ;
+    return result;
 }
 
-
 std::vector<miniplc0::Token> _tokenize(std::istream& input) {
 	miniplc0::Tokenizer tkz(input);
 	auto p = tkz.AllTokens();
@@ -106,29 +88,164 @@ void Tokenize(std::istream& input, std::ostream& output) {
 	return;
 }
 
-void Analyse(std::istream& input, std::ostream& output){
-	auto tks = _tokenize(input);
-	miniplc0::Analyser analyser(tks);
-	auto p = analyser.Analyse();
-	if (p.second.has_value()) {
-		fmt::print(stderr, "Syntactic analysis error: {}\n", p.second.value());
-		exit(2);
-	}
+void printStatistics(const std::vector<miniplc0::OptimizationStatistics>& statistics) {
+    for (auto& it : statistics) {
+        if (it._removed)
+            fmt::print(stderr, "{}: removed, instructions {}, bytes {}\n", it._name, it._instructions_before, it._bytes_before);
+        else
+            fmt::print(stderr, "{}: instructions {} -> {}, bytes {} -> {}, dead store instructions {}\n", it._name,
+                       it._instructions_before, it._instructions_after, it._bytes_before, it._bytes_after,
+                       it._dead_store_instructions);
+    }
+}
 
-	miniplc0::Symbols constants = analyser._constants;
-	miniplc0::Symbols functions = analyser._functions;
-	std::vector<miniplc0::Instruction> start = analyser._start;
-    std::vector<miniplc0::FunctionBody> functionbody = analyser._function_body;
+void printPassStatistics(const std::vector<miniplc0::PassStatistics>& statistics) {
+    for (auto& it : statistics)
+        fmt::print(stderr, "pass {}: {:.3f} ms, instructions {} -> {}\n", it._name, it._milliseconds,
+                   it._instructions_before, it._instructions_after);
+}
+
+void Optimize(miniplc0::Symbols& constants, miniplc0::Symbols& functions, std::vector<miniplc0::Instruction>& start,
+              std::vector<miniplc0::FunctionBody>& functionbody, const miniplc0::OptimizationOptions& options) {
+    miniplc0::Optimizer optimizer(constants, functions, start, functionbody, options._inline_budget, options._specialize_budget,
+                                  options._evaluate_budget);
+    if (options._profile_use)
+        optimizer.SetProfile(&options._profile);
+    auto stat = optimizer.Optimize(options._level, options._jobs);
+    if (options._statistics) {
+        printStatistics(stat);
+        printPassStatistics(optimizer.GetPassStatistics());
+    }
+}
+
+void InstrumentProfile(miniplc0::Symbols& constants, miniplc0::Symbols& functions, std::vector<miniplc0::Instruction>& start,
+                       std::vector<miniplc0::FunctionBody>& functionbody) {
+    miniplc0::Optimizer optimizer(constants, functions, start, functionbody);
+    optimizer.InstrumentProfile();
+}
+
+std::vector<int32_t> ExtractData(miniplc0::Symbols& constants, miniplc0::Symbols& functions, std::vector<miniplc0::Instruction>& start,
+                                 std::vector<miniplc0::FunctionBody>& functionbody) {
+    miniplc0::Optimizer optimizer(constants, functions, start, functionbody);
+    return optimizer.ExtractData();
+}
+
+void SelectSuperinstructions(miniplc0::Symbols& constants, miniplc0::Symbols& functions, std::vector<miniplc0::Instruction>& start,
+                             std::vector<miniplc0::FunctionBody>& functionbody) {
+    miniplc0::Optimizer optimizer(constants, functions, start, functionbody);
+    optimizer.SelectSuperinstructions();
+}
+
+// 生成插桩代码和使用执行计数时，分析器不旋转循环，两次编译得到相同的代码，计数的下标才能对应
+bool CanonicalCode(const miniplc0::OptimizationOptions& options) {
+    return options._profile_generate || (options._profile_use && options._level > 0);
+}
 
-    long long unsigned int i,j;
+// 创建源程序的分析器。使用增量编译缓存时读入整个源程序，由分析器按函数切开，只对缓存中没有的函数做词法分析；
+// 不能切开时和不使用缓存时一样先对整个源程序做词法分析
+std::unique_ptr<miniplc0::Analyser> MakeAnalyser(std::istream& input, const miniplc0::OptimizationOptions& options) {
+    bool optimize = options._level > 0 || CanonicalCode(options);
+    if (options._cache.empty())
+        return std::make_unique<miniplc0::Analyser>(_tokenize(input), optimize, !CanonicalCode(options));
+    std::string source((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    auto analyser = std::make_unique<miniplc0::Analyser>(std::vector<miniplc0::Token>(), optimize, !CanonicalCode(options));
+    if (analyser->SetSource(source))
+        return analyser;
+    std::istringstream text(source);
+    return std::make_unique<miniplc0::Analyser>(_tokenize(text), optimize, !CanonicalCode(options));
+}
+
+// 分析源程序，出错时报错退出。options._cache 不为空并且源程序能按函数切开时使用这个文件作为增量编译缓存：
+// 没有改动的函数直接使用缓存中的分析结果，分析之后写回本次用到的函数。
+// 缓存文件不存在或者格式不对时从空的缓存开始，写入失败只给出警告
+void RunAnalyser(miniplc0::Analyser& analyser, const miniplc0::OptimizationOptions& options) {
+    miniplc0::FunctionCache cache;
+    bool cached = !options._cache.empty() && !analyser._source_functions.empty();
+    if (cached) {
+        std::ifstream file(options._cache, std::ios::in | std::ios::binary);
+        if (file)
+            cache.Load(file);
+        analyser._cache = &cache;
+    }
+    auto p = analyser.Analyse();
+    if (p.second.has_value()) {
+        auto err = p.second.value();
+        //按函数分析时错误的位置不对，重新完整地分析，得到和不使用缓存时相同的错误
+        if (cached) {
+            std::istringstream text(analyser._source);
+            miniplc0::Analyser full(_tokenize(text), analyser._optimize, analyser._rotate_loops);
+            auto q = full.Analyse();
+            if (q.second.has_value())
+                err = q.second.value();
+        }
+        fmt::print(stderr, "Syntactic analysis error: {}\n", err);
+        exit(2);
+    }
+    if (!cached)
+        return;
+    if (options._statistics)
+        fmt::print(stderr, "cache: {} functions reused, {} analysed\n", cache.Hits(), cache.Misses());
+    if (!cache.Changed())
+        return;
+    //先写到临时文件再改名，中断时不会留下不完整的缓存
+    std::string temporary = options._cache + ".tmp";
+    std::ofstream out(temporary, std::ios::out | std::ios::trunc | std::ios::binary);
+    std::error_code ec;
+    if (!out || !cache.Save(out) || !out.flush()) {
+        fmt::print(stderr, "Warning: fail to write the cache {}.\n", options._cache);
+        std::filesystem::remove(temporary, ec);
+        return;
+    }
+    out.close();
+    std::filesystem::rename(temporary, options._cache, ec);
+    if (ec)
+        fmt::print(stderr, "Warning: fail to write the cache {}: {}\n", options._cache, ec.message());
+}
+
+// 启动代码和每个函数的栈的最大高度，第 0 项为启动代码，包括数据段的 data 个值
+// 栈高度不一致说明代码生成有错误，报错退出
+std::vector<int32_t> MaxStackDepths(miniplc0::Symbols& constants, miniplc0::Symbols& functions, std::vector<miniplc0::Instruction>& start,
+                                    std::vector<miniplc0::FunctionBody>& functionbody, int32_t data) {
+    miniplc0::Optimizer optimizer(constants, functions, start, functionbody);
+    std::vector<int32_t> result;
+    auto analyse = [&](const std::vector<miniplc0::Instruction>& code, int32_t params, const std::string& name) {
+        int32_t max, where;
+        if (!optimizer.MaxStackDepth(code, params, max, where)) {
+            fmt::print(stderr, "Stack depth analysis error: inconsistent stack height in {} at instruction {}\n", name, where);
+            exit(2);
+        }
+        result.emplace_back(max);
+    };
+    analyse(start, data, ".start");
+    for (size_t i = 0; i < functionbody.size(); i++)
+        analyse(functionbody.at(i)._instruction, functions._table.at(i).GetParams(), functions._table.at(i).GetName());
+    return result;
+}
+
+// 文本格式中函数体之前的部分：常量表、第 3 版的数据段、启动代码和函数表
+void WriteTextHeader(std::ostream& output, const miniplc0::OptimizationOptions& options, const miniplc0::Symbols& constants,
+                     const miniplc0::Symbols& functions, const std::vector<miniplc0::Instruction>& start,
+                     const std::vector<int32_t>& data, const std::vector<int32_t>& max_stack) {
+    long long unsigned int i;
 
     output << ".constants:" << std::endl;
     for(i=0; i<constants._table.size(); i++)
     {
-        output << i << " S " << "\"" << constants._table.at(i).GetName() << "\"" << std::endl;
+        output << i << " S " << "\"" << escapeString(constants._table.at(i).GetName()) << "\"" << std::endl;
+    }
+
+    //数据段：全局变量的初值，加载时依次压入启动代码的栈帧
+    if (options._version >= 3) {
+        output << ".data:" << std::endl;
+        for(i=0; i<data.size(); i++)
+            output << i << " " << data.at(i) << std::endl;
     }
 
-    output << ".start:" << std::endl;
+    //栈的最大高度附加在 .start: 和 .functions: 的每一行末尾
+    if (options._max_stack)
+        output << ".start: " << max_stack.at(0) << std::endl;
+    else
+        output << ".start:" << std::endl;
     for(i=0; i<start.size(); i++)
     {
         output << i << " " << fmt::format("{}", start.at(i)) << std::endl;
@@ -136,88 +253,309 @@ void Analyse(std::istream& input, std::ostream& output){
 
     output << ".functions:" << std::endl;
     for(i=0; i<functions._table.size(); i++) {
-        output << i << " " << i << " " << functions._table.at(i).GetParams() << " " << "1" << std::endl;
+        output << i << " " << functions._table.at(i).GetIndex() << " " << functions._table.at(i).GetParams() << " " << "1";
+        if (options._max_stack)
+            output << " " << max_stack.at(i + 1);
+        output << std::endl;
     }
+}
 
-	auto v = p.first;
-	for(i=0; i<p.first.size(); i++)
-    {
-	    auto it = p.first.at(i)._instruction;
-	    output << ".F" << i << ":" << std::endl;
-	    for(j=0; j<it.size(); j++)
-        {
-	        output << j << " " << fmt::format("{}", it.at(j)) << std::endl;
-        }
-    }
+// 文本格式中第 i 个函数的函数体
+std::string TextFunction(size_t i, const std::vector<miniplc0::Instruction>& code) {
+    std::string result = fmt::format(".F{}:\n", i);
+    for (size_t j = 0; j < code.size(); j++)
+        result += fmt::format("{} {}\n", j, code.at(j));
+    return result;
+}
+
+void Analyse(std::istream& input, std::ostream& output, const miniplc0::OptimizationOptions& options){
+	auto owner = MakeAnalyser(input, options);
+	auto& analyser = *owner;
+	RunAnalyser(analyser, options);
+
+	miniplc0::Symbols constants = analyser._constants;
+	miniplc0::Symbols functions = analyser._functions;
+	std::vector<miniplc0::Instruction> start = analyser._start;
+    std::vector<miniplc0::FunctionBody> functionbody = analyser._function_body;
+    if (options._profile_generate)
+        InstrumentProfile(constants, functions, start, functionbody);
+    else if (options._level > 0)
+        Optimize(constants, functions, start, functionbody, options);
+    std::vector<int32_t> data;
+    if (options._version >= 3)
+        data = ExtractData(constants, functions, start, functionbody);
+    if (options._version >= 2)
+        SelectSuperinstructions(constants, functions, start, functionbody);
+
+    std::vector<int32_t> max_stack;
+    if (options._max_stack)
+        max_stack = MaxStackDepths(constants, functions, start, functionbody, data.size());
+
+    WriteTextHeader(output, options, constants, functions, start, data, max_stack);
+	for(size_t i=0; i<functionbody.size(); i++)
+	    output << TextFunction(i, functionbody.at(i)._instruction);
 	return;
 }
 
-void BinaryAnalyse(std::istream& input, std::ostream& output){
-    auto tks = _tokenize(input);
-    miniplc0::Analyser analyser(tks);
-    auto p = analyser.Analyse();
-    if (p.second.has_value()) {
-        fmt::print(stderr, "Syntactic analysis error: {}\n", p.second.value());
-        exit(2);
+// 函数数达到这个值时并行编码，否则启动线程的开销比编码还大
+const size_t ParallelEncodeThreshold = 256;
+
+// 二进制格式中函数体之前的部分：魔数、版本、常量表、第 3 版的数据段、启动代码和函数的个数
+std::string BinaryHeader(const miniplc0::OptimizationOptions& options, const miniplc0::Symbols& constants,
+                         const miniplc0::Symbols& functions, const std::vector<miniplc0::Instruction>& start,
+                         const std::vector<int32_t>& data) {
+    std::string header;
+    appendBigEndian(header, 0x43303a29, 4);
+    appendBigEndian(header, (u4)options._version, 4);
+
+    appendBigEndian(header, (u4)constants._table.size(), 2);
+    for (auto& it : constants._table) {
+        header.push_back(0);
+        appendBigEndian(header, (u4)it.GetName().length(), 2);
+        header += it.GetName();
+    }
+
+    //第 3 版：数据段，u2 个数之后是每个值的 u4
+    if (options._version >= 3) {
+        appendBigEndian(header, (u4)data.size(), 2);
+        for (auto value : data)
+            appendBigEndian(header, (u4)value, 4);
     }
 
+    appendCode(header, start);
+    appendBigEndian(header, (u4)functions._table.size(), 2);
+    return header;
+}
+
+// 追加一个函数：名字的常量下标、参数个数、层次和代码
+void appendFunction(std::string& buffer, const miniplc0::Tableitem& function, const std::vector<miniplc0::Instruction>& code) {
+    appendBigEndian(buffer, (u4)function.GetIndex(), 2);
+    appendBigEndian(buffer, (u4)function.GetParams(), 2);
+    appendBigEndian(buffer, 1, 2);
+    appendCode(buffer, code);
+}
+
+// 扩展字段：启动代码和每个函数的栈的最大高度，各一个 u4
+std::string BinaryTrailer(const miniplc0::OptimizationOptions& options, const std::vector<int32_t>& max_stack) {
+    std::string trailer;
+    if (options._max_stack)
+        for (auto depth : max_stack)
+            appendBigEndian(trailer, (u4)depth, 4);
+    return trailer;
+}
+
+// 按 o0 的二进制格式输出，版本和是否附加栈的最大高度由 options 决定，data 为第 3 版的数据段
+// 整个文件拼接好之后一次写入
+void WriteBinary(std::ostream& output, const miniplc0::OptimizationOptions& options, const miniplc0::Symbols& constants,
+                 const miniplc0::Symbols& functions, const std::vector<miniplc0::Instruction>& start,
+                 const std::vector<miniplc0::FunctionBody>& functionbody, const std::vector<int32_t>& data,
+                 const std::vector<int32_t>& max_stack) {
+    auto header = BinaryHeader(options, constants, functions, start, data);
+
+    //每个函数编码到自己的缓冲区，函数多时并行，最后按顺序拼接
+    std::vector<std::string> bodies(functionbody.size());
+    auto encode = [&](size_t i) {
+        appendFunction(bodies.at(i), functions._table.at(i), functionbody.at(i)._instruction);
+    };
+    miniplc0::WorkerPool pool(functionbody.size() < ParallelEncodeThreshold ? 1 : options._jobs);
+    pool.run(functionbody.size(), encode);
+
+    auto trailer = BinaryTrailer(options, max_stack);
+
+    size_t total = header.size() + trailer.size();
+    for (auto& it : bodies)
+        total += it.size();
+    std::string file;
+    file.reserve(total);
+    file += header;
+    for (auto& it : bodies)
+        file += it;
+    file += trailer;
+    output.write(file.data(), file.size());
+}
+
+void BinaryAnalyse(std::istream& input, std::ostream& output, const miniplc0::OptimizationOptions& options){
+    auto owner = MakeAnalyser(input, options);
+    auto& analyser = *owner;
+    RunAnalyser(analyser, options);
+
     miniplc0::Symbols constants = analyser._constants;
     miniplc0::Symbols functions = analyser._functions;
     std::vector<miniplc0::Instruction> start = analyser._start;
     std::vector<miniplc0::FunctionBody> functionbody = analyser._function_body;
+    if (options._profile_generate)
+        InstrumentProfile(constants, functions, start, functionbody);
+    else if (options._level > 0)
+        Optimize(constants, functions, start, functionbody, options);
+    std::vector<int32_t> data;
+    if (options._version >= 3)
+        data = ExtractData(constants, functions, start, functionbody);
+    if (options._version >= 2)
+        SelectSuperinstructions(constants, functions, start, functionbody);
+    std::vector<int32_t> max_stack;
+    if (options._max_stack)
+        max_stack = MaxStackDepths(constants, functions, start, functionbody, data.size());
+
+    WriteBinary(output, options, constants, functions, start, functionbody, data, max_stack);
+}
 
+// 复制缓冲文件的全部内容到 output
+void CopySpill(std::FILE* spill, std::ostream& output) {
+    std::rewind(spill);
+    std::vector<char> chunk(1 << 16);
+    size_t size;
+    while ((size = std::fread(chunk.data(), 1, chunk.size(), spill)) > 0)
+        output.write(chunk.data(), size);
+}
 
-    u4 magic = 0x43303a29;
-    magic = transToInt32(magic);
-    output.write((char*)&magic, sizeof(u4));
-
-    u4 version = 1;
-    version = transToInt32(version);
-    output.write((char*)&version, sizeof(u4));
-
-    u2 constants_count = (u2)constants._table.size();
-    constants_count = transToInt16(constants_count);
-    output.write((char*)&constants_count, sizeof(u2));
-
-    long long unsigned int i;
-    for(i=0; i<constants._table.size(); i++)
-    {
-        u1 type = 0;
-        output.write((char*)&type, sizeof(u1));
-        u2 length = constants._table.at(i).GetName().length();
-        length = transToInt16(length);
-        output.write((char*)&length, sizeof(u2));
-        output << constants._table.at(i).GetName();
+// --stream：每个函数分析完就选择超级指令、求栈的最大高度并编码，写到临时文件后释放它的指令，
+// 内存中只保留启动代码、常量表、函数表和正在分析的函数。
+// 常量表在函数体之前并且长度可变，分析完之前不知道，所以函数体先写到临时文件，最后接在文件头之后
+void StreamAnalyse(std::istream& input, std::ostream& output, const miniplc0::OptimizationOptions& options, bool binary) {
+    std::FILE* spill = std::tmpfile();
+    if (!spill) {
+        fmt::print(stderr, "Fail to create a temporary file.\n");
+        exit(2);
     }
+    auto owner = MakeAnalyser(input, options);
+    auto& analyser = *owner;
+    std::vector<miniplc0::FunctionBody> none;
+    miniplc0::Optimizer optimizer(analyser._constants, analyser._functions, analyser._start, none);
+    //第 0 项为启动代码，最后再求
+    std::vector<int32_t> max_stack(1, 0);
+    auto maxStack = [&](const std::vector<miniplc0::Instruction>& code, int32_t params, const std::string& name) {
+        int32_t max, where;
+        if (!optimizer.MaxStackDepth(code, params, max, where)) {
+            fmt::print(stderr, "Stack depth analysis error: inconsistent stack height in {} at instruction {}\n", name, where);
+            exit(2);
+        }
+        return max;
+    };
+    analyser._emit = [&](int32_t i, miniplc0::FunctionBody& body) {
+        auto& function = analyser._functions._table.at(i);
+        auto& code = body._instruction;
+        if (options._version >= 2)
+            optimizer.SelectSuperinstructions(code, function.GetParams());
+        if (options._max_stack)
+            max_stack.emplace_back(maxStack(code, function.GetParams(), function.GetName()));
+        std::string buffer;
+        if (binary)
+            appendFunction(buffer, function, code);
+        else
+            buffer = TextFunction(i, code);
+        if (std::fwrite(buffer.data(), 1, buffer.size(), spill) != buffer.size()) {
+            fmt::print(stderr, "Fail to write the temporary file.\n");
+            exit(2);
+        }
+    };
+    RunAnalyser(analyser, options);
+
+    auto& start = analyser._start;
+    std::vector<int32_t> data;
+    if (options._version >= 3)
+        data = optimizer.ExtractData();
+    if (options._version >= 2)
+        optimizer.SelectSuperinstructions(start, 0);
+    if (options._max_stack)
+        max_stack.at(0) = maxStack(start, data.size(), ".start");
+
+    if (binary) {
+        auto header = BinaryHeader(options, analyser._constants, analyser._functions, start, data);
+        output.write(header.data(), header.size());
+        CopySpill(spill, output);
+        auto trailer = BinaryTrailer(options, max_stack);
+        output.write(trailer.data(), trailer.size());
+    }
+    else {
+        WriteTextHeader(output, options, analyser._constants, analyser._functions, start, data, max_stack);
+        CopySpill(spill, output);
+    }
+    std::fclose(spill);
+}
 
-    u2 instructions_count = (u2)start.size();
-    instructions_count = transToInt16(instructions_count);
-    output.write((char*)&instructions_count, sizeof(u2));
-    for(i=0; i<start.size(); i++)
-        instructionBinaryOutput(start.at(i), output);
-
-    u2 functions_count = (u2)functions._table.size();
-    functions_count = transToInt16(functions_count);
-    output.write((char*)&functions_count, sizeof(u2));
+// 优化一个 o0 文件，输出相同版本的 o0 文件，出错时返回错误信息
+std::optional<std::string> OptimizeObject(std::istream& input, std::ostream& output, miniplc0::OptimizationOptions options) {
+    miniplc0::Module module;
+    auto err = miniplc0::ReadModule(input, module);
+    if (err.has_value())
+        return "load error: " + err.value();
+
+    miniplc0::Symbols constants;
+    miniplc0::Symbols functions;
+    std::vector<miniplc0::FunctionBody> functionbody;
+    for (size_t i = 0; i < module._constants.size(); i++)
+        constants.addConstantItem(module._constants.at(i), "S", i, module._constants.at(i));
+    for (auto& it : module._functions) {
+        //文件中没有返回类型，有 IRET 的是 int 函数
+        bool returnsInt = std::any_of(it._instruction.begin(), it._instruction.end(),
+                                      [](const miniplc0::Instruction& ins) { return ins.GetOperation() == miniplc0::Operation::IRET; });
+        auto& name = module._constants.at(it._name_index);
+        functions.addFunctionItem(name, returnsInt ? "INT" : "VOID", it._name_index, it._params);
+        functionbody.emplace_back(miniplc0::FunctionBody());
+        functionbody.back()._instruction = it._instruction;
+    }
+    std::vector<miniplc0::Instruction> start = module._start;
+
+    miniplc0::Optimizer optimizer(constants, functions, start, functionbody);
+    optimizer.OptimizeBinary(options._jobs);
+    if (options._statistics)
+        printPassStatistics(optimizer.GetPassStatistics());
+    std::vector<int32_t> max_stack;
+    if (options._max_stack)
+        max_stack = MaxStackDepths(constants, functions, start, functionbody, module._data.size());
+    options._version = module._version;
+    WriteBinary(output, options, constants, functions, start, functionbody, module._data, max_stack);
+    return {};
+}
 
-    for(i=0; i<functionbody.size(); i++)
-    {
-        u2 name_index = (u2)functions._table.at(i).GetIndex();
-        u2 params_size = (u2)functions._table.at(i).GetParams();
-        u2 level = (u2)1;
-        u2 instructions_count = (u2)functionbody.at(i)._instruction.size();
-        name_index = transToInt16(name_index);
-        params_size = transToInt16(params_size);
-        level = transToInt16(level);
-        instructions_count = transToInt16(instructions_count);
-        output.write((char*)&name_index, sizeof(u2));
-        output.write((char*)&params_size, sizeof(u2));
-        output.write((char*)&level, sizeof(u2));
-        output.write((char*)&instructions_count, sizeof(u2));
-        long long unsigned int j;
-        for(j=0; j<functionbody.at(i)._instruction.size(); j++)
-            instructionBinaryOutput(functionbody.at(i)._instruction.at(j), output);
+// --opt 的输入是目录时，把其中每个 .o0 文件优化后写到输出目录中的同名文件，文件之间并行
+bool OptimizeDirectory(const std::string& input_dir, const std::string& output_dir, const miniplc0::OptimizationOptions& options) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_directories(output_dir, ec);
+    if (ec) {
+        fmt::print(stderr, "Fail to create directory {}: {}\n", output_dir, ec.message());
+        return false;
+    }
+    std::vector<fs::path> files;
+    for (auto& entry : fs::directory_iterator(input_dir, ec))
+        if (entry.is_regular_file() && entry.path().extension() == ".o0")
+            files.emplace_back(entry.path());
+    if (ec) {
+        fmt::print(stderr, "Fail to read directory {}: {}\n", input_dir, ec.message());
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    //每个文件单线程优化，错误信息按文件顺序输出
+    auto single = options;
+    single._jobs = 1;
+    single._statistics = false;
+    std::vector<std::optional<std::string>> errors(files.size());
+    miniplc0::WorkerPool pool(options._jobs);
+    pool.run(files.size(), [&](size_t i) {
+        std::ifstream inf(files.at(i), std::ios::in | std::ios::binary);
+        if (!inf) {
+            errors.at(i) = "fail to open for reading";
+            return;
+        }
+        //先写到内存中，出错时不留下不完整的文件
+        std::ostringstream out;
+        errors.at(i) = OptimizeObject(inf, out, single);
+        if (errors.at(i).has_value())
+            return;
+        std::ofstream outf(fs::path(output_dir) / files.at(i).filename(), std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!outf || !(outf << out.str()))
+            errors.at(i) = "fail to write the output";
+    });
+    bool ok = true;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (errors.at(i).has_value()) {
+            fmt::print(stderr, "{}: {}\n", files.at(i).string(), errors.at(i).value());
+            ok = false;
+        }
     }
+    return ok;
 }
 
 int main(int argc, char** argv) {
@@ -236,13 +574,88 @@ int main(int argc, char** argv) {
         .default_value(false)
         .implicit_value(true)
         .help("translate c0 source code to the binary object file.");
+	program.add_argument("-O0")
+        .default_value(false)
+        .implicit_value(true)
+        .help("do not optimize the generated code (default).");
+	program.add_argument("-O1")
+        .default_value(false)
+        .implicit_value(true)
+        .help("perform local optimizations.");
+	program.add_argument("-O2")
+        .default_value(false)
+        .implicit_value(true)
+        .help("also perform inlining, tail call elimination and loop invariant code motion.");
+	program.add_argument("-O")
+        .default_value(false)
+        .implicit_value(true)
+        .help("the same as -O2.");
+	program.add_argument("--stat")
+        .default_value(false)
+        .implicit_value(true)
+        .help("print the optimization statistics to stderr.");
+	program.add_argument("--inline-budget")
+        .default_value(16)
+        .action([](const std::string& value) { return std::stoi(value); })
+        .help("the max instructions of a function to be inlined, doubled for each loop level.");
+	program.add_argument("--specialize-budget")
+        .default_value(256)
+        .action([](const std::string& value) { return std::stoi(value); })
+        .help("the max total instructions of functions cloned for constant arguments.");
+	program.add_argument("--eval-budget")
+        .default_value(10000000)
+        .action([](const std::string& value) { return std::stoi(value); })
+        .help("the max instructions executed at compile time (-O2) to precompute the output before the first input, 0 to disable.");
+	program.add_argument("--jobs")
+        .default_value(0)
+        .action([](const std::string& value) { return std::stoi(value); })
+        .help("the number of threads for function level optimizations, 0 for the number of hardware threads.");
+	program.add_argument("--max-stack")
+        .default_value(false)
+        .implicit_value(true)
+        .help("emit the max stack depth of the start code and each function (extra field in o0).");
+	program.add_argument("--o0-version")
+        .default_value(1)
+        .action([](const std::string& value) { return std::stoi(value); })
+        .help("the version of the o0 format, 2 adds superinstructions for the frequent instruction pairs, 3 also adds a data segment for the initial values of globals.");
+	program.add_argument("-fprofile-generate")
+        .default_value(false)
+        .implicit_value(true)
+        .help("insert code counting the executions of each basic block, printed when main returns (no other optimization).");
+	program.add_argument("-fprofile-use")
+        .default_value(std::string(""))
+        .help("optimize with the counts in the output of a -fprofile-generate program (-fprofile-use=<file>).");
+	program.add_argument("--opt")
+        .default_value(false)
+        .implicit_value(true)
+        .help("optimize a compiled o0 file (or every .o0 file in a directory, in parallel) with dead function elimination and peephole optimization.");
+	program.add_argument("--cache")
+        .default_value(std::string(""))
+        .help("reuse the analysis of the functions unchanged since the last compilation with the same cache file (--cache <file>).");
+	program.add_argument("--stream")
+        .default_value(false)
+        .implicit_value(true)
+        .help("write each function as soon as it is compiled instead of keeping the whole program in memory (-O0 only, no profile).");
 	program.add_argument("-o", "--output")
 		.required()
 		.default_value(std::string("-"))
 		.help("specify the output file.");
 
+	//-fprofile-use=<file> 拆成两个参数
+	std::vector<std::string> arguments;
+	for (int i = 0; i < argc; i++) {
+		std::string argument = argv[i];
+		auto equal = argument.find('=');
+		if (argument.rfind("-fprofile-use=", 0) == 0) {
+			arguments.push_back(argument.substr(0, equal));
+			arguments.push_back(argument.substr(equal + 1));
+		}
+		else
+			arguments.push_back(argument);
+	}
+
 	try {
-		program.parse_args(argc, argv);
+		program.parse_args(arguments);
 	}
 	catch (const std::runtime_error& err) {
 		fmt::print(stderr, "{}\n\n", err.what());
@@ -256,7 +669,10 @@ int main(int argc, char** argv) {
 	std::ostream* output;
 	std::ifstream inf;
 	std::ofstream outf;
-	if (input_file != "-") {
+	//--opt 的输入是二进制文件或者目录，在后面打开
+	if (program["--opt"] == true)
+		input = nullptr;
+	else if (input_file != "-") {
 		inf.open(input_file, std::ios::in);
 		if (!inf) {
 			fmt::print(stderr, "Fail to open {} for reading.\n", input_file);
@@ -279,6 +695,77 @@ int main(int argc, char** argv) {
 		output = &std::cout;*/
 
 
+	miniplc0::OptimizationOptions options;
+	options._level = 0;
+	if (program["-O2"] == true || program["-O"] == true)
+		options._level = 2;
+	else if (program["-O1"] == true)
+		options._level = 1;
+	options._statistics = program["--stat"] == true;
+	options._inline_budget = program.get<int32_t>("--inline-budget");
+	options._specialize_budget = program.get<int32_t>("--specialize-budget");
+	options._evaluate_budget = std::max(0, program.get<int32_t>("--eval-budget"));
+	options._jobs = std::max(0, program.get<int32_t>("--jobs"));
+	options._max_stack = program["--max-stack"] == true;
+	options._version = program.get<int32_t>("--o0-version");
+	if (options._version < 1 || options._version > 3) {
+		fmt::print(stderr, "The version of the o0 format must be 1, 2 or 3.\n");
+		exit(2);
+	}
+	options._cache = program.get<std::string>("--cache");
+	options._profile_generate = program["-fprofile-generate"] == true;
+	auto profile_file = program.get<std::string>("-fprofile-use");
+	options._profile_use = !profile_file.empty();
+	if (options._profile_use) {
+		std::ifstream profile(profile_file);
+		if (!profile) {
+			fmt::print(stderr, "Fail to open {} for reading.\n", profile_file);
+			exit(2);
+		}
+		if (!miniplc0::ReadProfile(profile, options._profile)) {
+			fmt::print(stderr, "No profile found in {}.\n", profile_file);
+			exit(2);
+		}
+	}
+	if (options._profile_generate && options._profile_use) {
+		fmt::print(stderr, "You can not generate and use the profile at the same time.\n");
+		exit(2);
+	}
+
+	bool stream = program["--stream"] == true;
+	if (stream && (options._level > 0 || options._profile_generate || options._profile_use)) {
+		fmt::print(stderr, "--stream can only be used with -O0 and without profile.\n");
+		exit(2);
+	}
+
+	if (program["--opt"] == true) {
+		if (std::filesystem::is_directory(input_file)) {
+			if (output_file == "-") {
+				fmt::print(stderr, "You must specify the output directory.\n");
+				exit(2);
+			}
+			return OptimizeDirectory(input_file, output_file, options) ? 0 : 2;
+		}
+		std::ifstream object(input_file, std::ios::in | std::ios::binary);
+		if (!object) {
+			fmt::print(stderr, "Fail to open {} for reading.\n", input_file);
+			exit(2);
+		}
+		std::ostringstream result;
+		auto err = OptimizeObject(object, result, options);
+		if (err.has_value()) {
+			fmt::print(stderr, "{}: {}\n", input_file, err.value());
+			exit(2);
+		}
+		outf.open(output_file == "-" ? "out" : output_file, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!outf) {
+			fmt::print(stderr, "Fail to open {} for writing.\n", output_file);
+			exit(2);
+		}
+		outf << result.str();
+		return 0;
+	}
+
 	if (program["-s"] == true && program["-c"] == true) {
 		fmt::print(stderr, "You can only translate c0 source code to one file.");
 		exit(2);
@@ -323,7 +810,10 @@ int main(int argc, char** argv) {
             }
             output = &outf;
         }
-        Analyse(*input, *output);
+        if (stream)
+            StreamAnalyse(*input, *output, options, false);
+        else
+            Analyse(*input, *output, options);
 	}
 	else if (program["-c"] == true) {
         if (output_file != "-") {
@@ -344,7 +834,10 @@ int main(int argc, char** argv) {
             output = &outf;
         }
         //二进制输出
-        BinaryAnalyse(*input, *output);
+        if (stream)
+            StreamAnalyse(*input, *output, options, true);
+        else
+            BinaryAnalyse(*input, *output, options);
 	}
 	else {
 		fmt::print(stderr, "You must choose tokenization or syntactic analysis.");
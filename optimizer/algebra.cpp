@@ -0,0 +1,244 @@
+#include "optimizer.h"
+
+#include <algorithm>
+
+namespace miniplc0 {
+
+    //只由这些指令组成的代码段是一个表达式，除 IDIV 外没有副作用
+    static bool isSimple(Operation opr) {
+        switch (opr) {
+            case Operation::BIPUSH:
+            case Operation::IPUSH:
+            case Operation::LOADA:
+            case Operation::ILOAD:
+            case Operation::IADD:
+            case Operation::ISUB:
+            case Operation::IMUL:
+            case Operation::IDIV:
+            case Operation::INEG:
+            case Operation::ICMP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    //[j, end) 只由简单指令组成并且恰好压入一个值时返回 j，否则返回 -1
+    static int32_t operandStart(const std::vector<Instruction>& code, int32_t end) {
+        //还需要 [j, end) 产生的值的个数
+        int32_t need = 1;
+        for (int32_t j = end - 1; j >= 0; j--) {
+            auto opr = code.at(j).GetOperation();
+            if (!isSimple(opr))
+                return -1;
+            if (opr == Operation::BIPUSH || opr == Operation::IPUSH || opr == Operation::LOADA)
+                need--;
+            else if (opr != Operation::ILOAD && opr != Operation::INEG)
+                need++;
+            if (need == 0)
+                return j;
+        }
+        return -1;
+    }
+
+    //代数化简和强度削弱，x 为只由简单指令组成的表达式，运算都按 32 位补码：
+    //  x; PUSH 0; IADD/ISUB    ->  x                 x+0 = x-0 = x
+    //  x; PUSH 1; IMUL/IDIV    ->  x                 x*1 = x/1 = x
+    //  x; PUSH -1; IMUL        ->  x; INEG           x*(2^32-1) ≡ -x
+    //  x; PUSH 0; IMUL         ->  PUSH 0            x 没有副作用时
+    //  PUSH c; x; op           ->  同上              IADD、IMUL 可交换
+    //  PUSH 0; x; ISUB         ->  x; INEG           0-x = -x
+    //  x; x; ISUB              ->  PUSH 0            两个 x 相同并且没有副作用
+    //  INEG; INEG              ->  删除              -(-x) = x，包括 INT_MIN
+    //  INEG; IADD / INEG; ISUB ->  ISUB / IADD       a+(-b) = a-b，a-(-b) = a+b
+    //  PUSH a; ±; PUSH b; ±    ->  PUSH ±a±b; IADD   模 2^32 的加法满足结合律
+    //  PUSH a; IMUL; PUSH b; IMUL  ->  PUSH a*b; IMUL    模 2^32 的乘法满足结合律
+    //x / -1 不改写，INT_MIN / -1 和常量折叠一样留到运行时。o0 没有移位指令，除以常量没有更便宜的写法，
+    //乘以 2 由 reduceStrength 在最后改写。
+    //被改写的指令中除第一条外不能是跳转目标
+    bool Optimizer::simplifyAlgebra(std::vector<Instruction>& code) {
+        auto isPush = [&](int32_t i) {
+            auto opr = code.at(i).GetOperation();
+            return opr == Operation::BIPUSH || opr == Operation::IPUSH;
+        };
+        auto push = [](int32_t value) {
+            return Instruction(value >= 0 && value <= 127 ? Operation::BIPUSH : Operation::IPUSH, value, 0);
+        };
+        auto isPure = [&](int32_t from, int32_t to) {
+            for (int32_t k = from; k < to; k++)
+                if (code.at(k).GetOperation() == Operation::IDIV)
+                    return false;
+            return true;
+        };
+
+        bool changed = false;
+        bool again = true;
+        while (again) {
+            again = false;
+            int32_t n = code.size();
+            std::vector<bool> isTarget(n + 1, false);
+            for (auto& it : code)
+                if (isJump(it.GetOperation()))
+                    isTarget.at(it.GetX()) = true;
+            //(from, to] 中没有跳转目标
+            auto straight = [&](int32_t from, int32_t to) {
+                for (int32_t k = from + 1; k <= to; k++)
+                    if (isTarget.at(k))
+                        return false;
+                return true;
+            };
+
+            int32_t from = 0, to = 0;
+            std::vector<Instruction> replacement;
+            //x 为 [begin, end)，把 [from, to) 换成 x 之后接 tail
+            auto keep = [&](int32_t begin, int32_t end, std::vector<Instruction> tail) {
+                replacement.assign(code.begin() + begin, code.begin() + end);
+                replacement.insert(replacement.end(), tail.begin(), tail.end());
+            };
+            for (int32_t i = 1; i < n && !again; i++) {
+                auto opr = code.at(i).GetOperation();
+                if (opr != Operation::IADD && opr != Operation::ISUB && opr != Operation::IMUL
+                    && opr != Operation::IDIV && opr != Operation::INEG)
+                    continue;
+                again = true;
+                auto previous = code.at(i - 1).GetOperation();
+
+                if (opr == Operation::INEG) {
+                    if (previous == Operation::INEG && !isTarget.at(i)) {
+                        from = i - 1, to = i + 1;
+                        replacement.clear();
+                        continue;
+                    }
+                }
+                else if (previous == Operation::INEG && opr != Operation::IMUL && opr != Operation::IDIV && !isTarget.at(i)) {
+                    from = i - 1, to = i + 1;
+                    replacement = {Instruction(opr == Operation::IADD ? Operation::ISUB : Operation::IADD, 0, 0)};
+                    continue;
+                }
+                else if (isPush(i - 1) && !isTarget.at(i)) {
+                    //第二个操作数是常量
+                    int32_t c = code.at(i - 1).GetX();
+                    bool additive = opr == Operation::IADD || opr == Operation::ISUB;
+                    if (additive && c == 0) {
+                        from = i - 1, to = i + 1;
+                        replacement.clear();
+                        continue;
+                    }
+                    if (additive && i >= 3 && isPush(i - 3) && straight(i - 3, i)
+                        && (code.at(i - 2).GetOperation() == Operation::IADD || code.at(i - 2).GetOperation() == Operation::ISUB)) {
+                        auto a = (uint32_t)code.at(i - 3).GetX(), b = (uint32_t)c;
+                        uint32_t sum = (code.at(i - 2).GetOperation() == Operation::IADD ? a : 0u - a) + (opr == Operation::IADD ? b : 0u - b);
+                        from = i - 3, to = i + 1;
+                        replacement = {push((int32_t)sum), Instruction(Operation::IADD, 0, 0)};
+                        continue;
+                    }
+                    if ((opr == Operation::IMUL || opr == Operation::IDIV) && c == 1) {
+                        from = i - 1, to = i + 1;
+                        replacement.clear();
+                        continue;
+                    }
+                    if (opr == Operation::IMUL) {
+                        if (c == -1) {
+                            from = i - 1, to = i + 1;
+                            replacement = {Instruction(Operation::INEG, 0, 0)};
+                            continue;
+                        }
+                        int32_t j = operandStart(code, i - 1);
+                        if (c == 0 && j >= 0 && isPure(j, i - 1) && straight(j, i)) {
+                            from = j, to = i + 1;
+                            replacement = {push(0)};
+                            continue;
+                        }
+                        if (i >= 3 && isPush(i - 3) && code.at(i - 2).GetOperation() == Operation::IMUL && straight(i - 3, i)) {
+                            auto product = (uint32_t)code.at(i - 3).GetX() * (uint32_t)c;
+                            from = i - 3, to = i + 1;
+                            replacement = {push((int32_t)product), Instruction(Operation::IMUL, 0, 0)};
+                            continue;
+                        }
+                    }
+                }
+
+                if (opr != Operation::IDIV && opr != Operation::INEG) {
+                    //第一个操作数是常量
+                    int32_t j = operandStart(code, i);
+                    if (j >= 1 && isPush(j - 1) && straight(j - 1, i)) {
+                        int32_t c = code.at(j - 1).GetX();
+                        from = j - 1, to = i + 1;
+                        if (c == 0 && opr == Operation::IADD)
+                            keep(j, i, {});
+                        else if (c == 0 && opr == Operation::ISUB)
+                            keep(j, i, {Instruction(Operation::INEG, 0, 0)});
+                        else if (c == 0 && opr == Operation::IMUL && isPure(j, i))
+                            replacement = {push(0)};
+                        else if (c == 1 && opr == Operation::IMUL)
+                            keep(j, i, {});
+                        else if (c == -1 && opr == Operation::IMUL)
+                            keep(j, i, {Instruction(Operation::INEG, 0, 0)});
+                        else
+                            j = -1;
+                        if (j >= 0)
+                            continue;
+                    }
+                    //x - x
+                    if (opr == Operation::ISUB && j >= 1) {
+                        int32_t k = operandStart(code, j);
+                        if (k >= 0 && j - k == i - j && std::equal(code.begin() + k, code.begin() + j, code.begin() + j)
+                            && isPure(k, i) && straight(k, i)) {
+                            from = k, to = i + 1;
+                            replacement = {push(0)};
+                            continue;
+                        }
+                    }
+                }
+                again = false;
+            }
+            if (again) {
+                replaceInstructions(code, from, to, replacement);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    //  x; PUSH 2; IMUL  ->  x; DUP; IADD      2x = x+x
+    //  PUSH 2; x; IMUL  ->  x; DUP; IADD
+    //DUP 不是公共子表达式消除和循环不变量外提能识别的表达式，所以在它们之后执行
+    bool Optimizer::reduceStrength(std::vector<Instruction>& code) {
+        bool changed = false;
+        bool again = true;
+        while (again) {
+            again = false;
+            int32_t n = code.size();
+            std::vector<bool> isTarget(n + 1, false);
+            for (auto& it : code)
+                if (isJump(it.GetOperation()))
+                    isTarget.at(it.GetX()) = true;
+            auto isTwo = [&](int32_t i) {
+                auto opr = code.at(i).GetOperation();
+                return (opr == Operation::BIPUSH || opr == Operation::IPUSH) && code.at(i).GetX() == 2;
+            };
+            std::vector<Instruction> twice = {Instruction(Operation::DUP, 0, 0), Instruction(Operation::IADD, 0, 0)};
+            for (int32_t i = 1; i < n && !again; i++) {
+                if (code.at(i).GetOperation() != Operation::IMUL || isTarget.at(i))
+                    continue;
+                if (isTwo(i - 1)) {
+                    replaceInstructions(code, i - 1, i + 1, twice);
+                    again = true;
+                    continue;
+                }
+                int32_t j = operandStart(code, i);
+                bool straight = j >= 1 && isTwo(j - 1);
+                for (int32_t k = j; straight && k < i; k++)
+                    straight = !isTarget.at(k);
+                if (straight) {
+                    std::vector<Instruction> replacement(code.begin() + j, code.begin() + i);
+                    replacement.insert(replacement.end(), twice.begin(), twice.end());
+                    replaceInstructions(code, j - 1, i + 1, replacement);
+                    again = true;
+                }
+            }
+            changed = changed || again;
+        }
+        return changed;
+    }
+}
@@ -0,0 +1,196 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <map>
+
+namespace miniplc0 {
+
+    //在每个基本块中模拟操作数栈，为栈上的每个值编号：
+    //  常量按值编号，LOADA x,y; ILOAD 按地址和该地址被写入的次数编号，
+    //  运算按运算符和操作数的编号编号（加法和乘法先排序操作数）。
+    //调用和读入产生新的编号；调用可能修改全局变量，之后全局变量的读取重新编号。
+    //一个纯的子表达式算完时，如果栈上更深处已经有相同编号的值：
+    //  紧挨在它下面时整段换成 DUP，否则换成 LOADA 0,d; ILOAD 读取栈上的这个值。
+    //start 为 true 时处理启动代码，此时全局变量就是 LOADA 0 访问的槽。
+    void Optimizer::eliminateCommonSubexpressions(std::vector<Instruction>& code, int32_t params, bool start) {
+        int32_t n = code.size();
+        std::vector<int32_t> depth;
+        if (!stackDepths(code, params, depth))
+            return;
+        std::vector<bool> leader(n + 1, false);
+        leader.at(0) = true;
+        for (int32_t i = 0; i < n; i++) {
+            auto opr = code.at(i).GetOperation();
+            if (isJump(opr))
+                leader.at(code.at(i).GetX()) = true;
+            if (isJump(opr) || isReturn(opr))
+                leader.at(i + 1) = true;
+        }
+
+        //栈上的一项，value 为 -1 表示地址或者未知的值
+        struct Entry {
+            int32_t value;
+            //计算这个值的指令从 from 开始，-1 表示在基本块之前
+            int32_t from;
+            //是否没有副作用，可以整段删除
+            bool pure;
+            //LOADA 压入的地址
+            int32_t x, y;
+        };
+        struct Candidate {
+            int32_t from, to;
+            std::vector<Instruction> replacement;
+        };
+        std::vector<Candidate> candidates;
+
+        std::map<std::vector<int64_t>, int32_t> numbers;
+        int32_t fresh = 0;
+        auto number = [&](const std::vector<int64_t>& key) {
+            auto it = numbers.find(key);
+            if (it != numbers.end())
+                return it->second;
+            return numbers[key] = fresh++;
+        };
+
+        for (int32_t b = 0; b < n; b++) {
+            if (!leader.at(b) || depth.at(b) < 0)
+                continue;
+            std::vector<Entry> stack(depth.at(b), Entry{-1, -1, false, -1, -1});
+            //每个地址被写入的次数，global 为全局变量被调用修改的次数，world 为任意写入的次数
+            std::map<std::pair<int32_t, int32_t>, int32_t> version;
+            int32_t global = 0, world = 0;
+            auto push = [&](Entry entry) {
+                //压栈也会写入 LOADA 0,栈高度 对应的槽
+                version[{0, (int32_t)stack.size()}]++;
+                stack.emplace_back(entry);
+            };
+            auto pop = [&]() {
+                Entry entry{-1, -1, false, -1, -1};
+                if (!stack.empty()) {
+                    entry = stack.back();
+                    stack.pop_back();
+                }
+                return entry;
+            };
+            //新的值算完后寻找栈上已有的相同的值
+            auto reuse = [&](int32_t to) {
+                auto& value = stack.back();
+                int32_t size = to - value.from + 1;
+                if (!value.pure || value.from < 0 || value.value < 0 || size < 2)
+                    return;
+                for (int32_t k = stack.size() - 2; k >= 0; k--) {
+                    if (stack.at(k).value != value.value)
+                        continue;
+                    if (k == (int32_t)stack.size() - 2)
+                        candidates.push_back({value.from, to, {Instruction(Operation::DUP, 0, 0)}});
+                    else if (size > 2)
+                        candidates.push_back({value.from, to, {Instruction(Operation::LOADA, 0, k), Instruction(Operation::ILOAD, 0, 0)}});
+                    return;
+                }
+            };
+
+            for (int32_t i = b; i < n && (i == b || !leader.at(i)); i++) {
+                auto& it = code.at(i);
+                auto opr = it.GetOperation();
+                switch (opr) {
+                    case Operation::BIPUSH:
+                    case Operation::IPUSH:
+                        push({number({0, it.GetX()}), i, true, -1, -1});
+                        break;
+                    case Operation::LOADA:
+                        push({-1, i, true, it.GetX(), it.GetY()});
+                        break;
+                    case Operation::ILOAD: {
+                        auto address = pop();
+                        if (address.x < 0) {
+                            push({fresh++, -1, false, -1, -1});
+                            break;
+                        }
+                        bool isGlobal = start ? address.x == 0 : address.x == 1;
+                        push({number({1, address.x, address.y, version[{address.x, address.y}], isGlobal ? global : 0, world}),
+                              address.from, address.pure, -1, -1});
+                        reuse(i);
+                        break;
+                    }
+                    case Operation::ISTORE: {
+                        pop();
+                        auto address = pop();
+                        if (address.x < 0)
+                            world++;
+                        else
+                            version[{address.x, address.y}]++;
+                        //写入的可能是栈上的值
+                        if (address.x < 0)
+                            for (auto& entry : stack)
+                                entry.value = -1;
+                        else if (address.x == 0 && address.y < (int32_t)stack.size())
+                            stack.at(address.y).value = -1;
+                        break;
+                    }
+                    case Operation::IADD:
+                    case Operation::ISUB:
+                    case Operation::IMUL:
+                    case Operation::IDIV: {
+                        auto rhs = pop();
+                        auto lhs = pop();
+                        int64_t l = lhs.value, r = rhs.value;
+                        if ((opr == Operation::IADD || opr == Operation::IMUL) && l > r)
+                            std::swap(l, r);
+                        int32_t value = lhs.value < 0 || rhs.value < 0 ? fresh++ : number({2, (int64_t)opr, l, r});
+                        push({value, lhs.from, lhs.pure && rhs.pure && lhs.from >= 0, -1, -1});
+                        reuse(i);
+                        break;
+                    }
+                    case Operation::INEG: {
+                        auto operand = pop();
+                        int32_t value = operand.value < 0 ? fresh++ : number({3, operand.value});
+                        push({value, operand.from, operand.pure && operand.from >= 0, -1, -1});
+                        reuse(i);
+                        break;
+                    }
+                    case Operation::DUP: {
+                        auto top = stack.empty() ? Entry{fresh++, -1, false, -1, -1} : stack.back();
+                        push({top.value, i, true, top.x, top.y});
+                        break;
+                    }
+                    case Operation::CALL: {
+                        auto& function = _functions._table.at(it.GetX());
+                        for (int32_t k = 0; k < function.GetParams(); k++)
+                            pop();
+                        //启动代码的栈上就是全局变量
+                        if (start) {
+                            world++;
+                            for (auto& entry : stack)
+                                entry.value = -1;
+                        }
+                        else
+                            global++;
+                        if (function.GetType() == "INT")
+                            push({fresh++, i, false, -1, -1});
+                        break;
+                    }
+                    default: {
+                        //其余指令只按栈高度的变化处理
+                        int32_t effect = isReturn(opr) ? 0 : stackEffect(it);
+                        for (int32_t k = 0; k < -effect; k++)
+                            pop();
+                        for (int32_t k = 0; k < effect; k++)
+                            push({fresh++, i, false, -1, -1});
+                        break;
+                    }
+                }
+            }
+        }
+
+        //子表达式的范围要么嵌套要么不相交，取最外层的
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.from != b.from ? a.from < b.from : a.to > b.to;
+        });
+        std::vector<Candidate> chosen;
+        for (auto& it : candidates)
+            if (chosen.empty() || it.from > chosen.back().to)
+                chosen.emplace_back(it);
+        for (auto it = chosen.rbegin(); it != chosen.rend(); it++)
+            replaceInstructions(code, it->from, it->to + 1, it->replacement);
+    }
+}
@@ -0,0 +1,128 @@
+#include "optimizer.h"
+
+namespace miniplc0 {
+
+    //数据段的值的个数是 u2
+    static const size_t DataLimit = 0xffff;
+
+    //在编译时执行启动代码的开头，执行到的位置之前的指令换成数据段，栈上的值就是数据段的内容。
+    //只执行压入常量、SNEW、读写启动代码栈帧中的槽和整数运算，遇到其他指令、跳转目标或者除法出错时停止，
+    //在此前最后一个栈上没有地址的位置切开
+    std::vector<int32_t> Optimizer::ExtractData() {
+        struct Value {
+            int32_t _value;
+            bool _address;
+        };
+        int32_t n = _start.size();
+        std::vector<bool> isTarget(n + 1, false);
+        for (auto& it : _start)
+            if (isJump(it.GetOperation()))
+                isTarget.at(it.GetX()) = true;
+
+        std::vector<Value> stack;
+        //栈上地址的个数
+        int32_t addresses = 0;
+        auto pop = [&]() {
+            auto value = stack.back();
+            stack.pop_back();
+            addresses -= value._address;
+            return value;
+        };
+        auto push = [&](int32_t value, bool address) {
+            stack.push_back({value, address});
+            addresses += address;
+        };
+        auto wrap = [](int64_t value) { return (int32_t)(uint32_t)value; };
+        //执行第 i 条指令，不能在编译时执行时返回 false
+        auto step = [&](int32_t i) {
+            auto& it = _start.at(i);
+            auto opr = it.GetOperation();
+            bool ok = true;
+            switch (opr) {
+                case Operation::BIPUSH:
+                case Operation::IPUSH:
+                    push(it.GetX(), false);
+                    break;
+                case Operation::SNEW:
+                    //未初始化的全局变量不会在赋值之前被读取
+                    ok = it.GetX() >= 0 && stack.size() + it.GetX() <= DataLimit;
+                    for (int32_t k = 0; ok && k < it.GetX(); k++)
+                        push(0, false);
+                    break;
+                case Operation::LOADA:
+                    ok = it.GetX() == 0 && it.GetY() >= 0;
+                    if (ok)
+                        push(it.GetY(), true);
+                    break;
+                case Operation::ILOAD:
+                    ok = !stack.empty() && stack.back()._address && stack.back()._value < (int32_t)stack.size() - 1
+                        && !stack.at(stack.back()._value)._address;
+                    if (ok)
+                        push(stack.at(pop()._value)._value, false);
+                    break;
+                case Operation::ISTORE:
+                    ok = stack.size() >= 2 && !stack.back()._address && stack.at(stack.size() - 2)._address
+                        && stack.at(stack.size() - 2)._value < (int32_t)stack.size() - 2;
+                    if (ok) {
+                        auto value = pop();
+                        stack.at(pop()._value) = value;
+                    }
+                    break;
+                case Operation::IADD:
+                case Operation::ISUB:
+                case Operation::IMUL:
+                case Operation::IDIV: {
+                    ok = stack.size() >= 2 && !stack.back()._address && !stack.at(stack.size() - 2)._address;
+                    if (!ok)
+                        break;
+                    int64_t b = stack.back()._value, a = stack.at(stack.size() - 2)._value;
+                    //除以 0 和 INT_MIN / -1 留到运行时报错
+                    if (opr == Operation::IDIV && (b == 0 || (a == INT32_MIN && b == -1))) {
+                        ok = false;
+                        break;
+                    }
+                    pop();
+                    pop();
+                    if (opr == Operation::IADD)
+                        push(wrap(a + b), false);
+                    else if (opr == Operation::ISUB)
+                        push(wrap(a - b), false);
+                    else if (opr == Operation::IMUL)
+                        push(wrap(a * b), false);
+                    else
+                        push((int32_t)(a / b), false);
+                    break;
+                }
+                case Operation::INEG:
+                    ok = !stack.empty() && !stack.back()._address;
+                    if (ok)
+                        push(wrap(-(int64_t)pop()._value), false);
+                    break;
+                case Operation::POP:
+                    ok = !stack.empty();
+                    if (ok)
+                        pop();
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+            return ok && stack.size() <= DataLimit;
+        };
+
+        //切开的位置是最后一次栈上没有地址的时候，第二次只执行到这里，得到那时的栈
+        int32_t cut = 0;
+        for (int32_t i = 0; i < n && !isTarget.at(i) && step(i); i++)
+            if (addresses == 0)
+                cut = i + 1;
+        stack.clear();
+        addresses = 0;
+        for (int32_t i = 0; i < cut; i++)
+            step(i);
+        std::vector<int32_t> data;
+        for (auto& value : stack)
+            data.emplace_back(value._value);
+        replaceInstructions(_start, 0, cut, {});
+        return data;
+    }
+}
@@ -0,0 +1,133 @@
+#include "optimizer.h"
+
+#include <algorithm>
+
+namespace miniplc0 {
+
+    //对栈帧中的每个槽做活跃分析，LOADA 0,k; <表达式>; ISTORE 写入的 k 在之后不活跃时，
+    //如果表达式没有副作用（没有调用、读入，除法的除数是非 0 且非 -1 的常量），整段删除。
+    //压栈也会写入槽，这里不把它当作写入，只会让变量显得更活跃。
+    //指令从栈上取操作数也是读取这些槽：内联后返回值存到栈上的槽中，再直接作为运算的操作数。
+    //删除一次赋值可能让之前的赋值也变成死存储，重复直到没有改动。
+    size_t Optimizer::eliminateDeadStores(int32_t function) {
+        auto& code = _function_body.at(function)._instruction;
+        int32_t params = _functions._table.at(function).GetParams();
+        size_t total = 0;
+        while (true) {
+            int32_t n = code.size();
+            std::vector<int32_t> depth;
+            if (!stackDepths(code, params, depth))
+                return total;
+            int32_t count = 0;
+            for (auto& it : code)
+                if (it.GetOperation() == Operation::LOADA && it.GetX() == 0)
+                    count = std::max(count, it.GetY() + 1);
+
+            std::vector<bool> isTarget(n + 1, false);
+            for (auto& it : code)
+                if (isJump(it.GetOperation()))
+                    isTarget.at(it.GetX()) = true;
+
+            //reads[i] 为指令 i 读取的槽
+            std::vector<std::vector<int32_t>> reads(n);
+            std::vector<int32_t> def(n, -1), address(n, -1);
+            for (int32_t i = 0; i < n; i++) {
+                auto& it = code.at(i);
+                int32_t d = depth.at(i);
+                if (d < 0)
+                    continue;
+                int32_t operands = 0;
+                switch (it.GetOperation()) {
+                    case Operation::IADD:
+                    case Operation::ISUB:
+                    case Operation::IMUL:
+                    case Operation::IDIV:
+                    case Operation::ICMP:
+                    case Operation::ISTORE:
+                        operands = 2;
+                        break;
+                    case Operation::INEG:
+                    case Operation::ILOAD:
+                    case Operation::DUP:
+                    case Operation::IPRINT:
+                    case Operation::CPRINT:
+                    case Operation::SPRINT:
+                    case Operation::IRET:
+                        operands = 1;
+                        break;
+                    case Operation::CALL:
+                        operands = _functions._table.at(it.GetX()).GetParams();
+                        break;
+                    default:
+                        operands = isConditionalJump(it.GetOperation()) ? 1 : 0;
+                        break;
+                }
+                for (int32_t k = std::max(0, d - operands); k < d; k++)
+                    reads.at(i).push_back(k);
+                count = std::max(count, d);
+                if (it.GetOperation() != Operation::LOADA || it.GetX() != 0)
+                    continue;
+                if (i + 1 < n && code.at(i + 1).GetOperation() == Operation::ILOAD) {
+                    reads.at(i).push_back(it.GetY());
+                    continue;
+                }
+                int32_t j = matchingStore(code, depth, i);
+                if (j >= 0) {
+                    def.at(j) = it.GetY();
+                    address.at(j) = i;
+                }
+            }
+
+            //每个槽的活跃性是独立的，一条指令读取多个槽时分几次求活跃变量再合并
+            size_t rounds = 0;
+            for (auto& it : reads)
+                rounds = std::max(rounds, it.size());
+            std::vector<std::vector<bool>> liveIn, liveOut;
+            std::vector<std::vector<bool>> roundIn, roundOut;
+            liveOut.assign(n, std::vector<bool>(count, false));
+            for (size_t r = 0; r < rounds; r++) {
+                std::vector<int32_t> use(n, -1);
+                for (int32_t i = 0; i < n; i++)
+                    if (r < reads.at(i).size())
+                        use.at(i) = reads.at(i).at(r);
+                liveness(code, use, def, count, roundIn, roundOut);
+                for (int32_t i = 0; i < n; i++)
+                    for (int32_t v = 0; v < count; v++)
+                        if (roundOut.at(i).at(v))
+                            liveOut.at(i).at(v) = true;
+            }
+
+            std::vector<bool> removed(n, false);
+            size_t removedCount = 0;
+            for (int32_t j = 0; j < n; j++) {
+                if (def.at(j) < 0 || liveOut.at(j).at(def.at(j)))
+                    continue;
+                int32_t i = address.at(j);
+                bool pure = true;
+                for (int32_t k = i + 1; k < j && pure; k++) {
+                    auto opr = code.at(k).GetOperation();
+                    if (isTarget.at(k) || removed.at(k))
+                        pure = false;
+                    else if (opr == Operation::IDIV) {
+                        auto& divisor = code.at(k - 1);
+                        pure = (divisor.GetOperation() == Operation::BIPUSH || divisor.GetOperation() == Operation::IPUSH)
+                            && divisor.GetX() != 0 && divisor.GetX() != -1;
+                    }
+                    else
+                        pure = opr == Operation::LOADA || opr == Operation::ILOAD || opr == Operation::BIPUSH || opr == Operation::IPUSH
+                            || opr == Operation::IADD || opr == Operation::ISUB || opr == Operation::IMUL || opr == Operation::INEG
+                            || opr == Operation::DUP;
+                }
+                if (!pure || isTarget.at(j))
+                    continue;
+                for (int32_t k = i; k <= j; k++)
+                    removed.at(k) = true;
+                removedCount += j - i + 1;
+            }
+            if (removedCount == 0)
+                return total;
+            removeInstructions(code, removed);
+            total += removedCount;
+        }
+    }
+}
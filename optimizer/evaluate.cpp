@@ -0,0 +1,132 @@
+#include "optimizer.h"
+#include "vm/vm.h"
+
+#include <map>
+#include <sstream>
+
+namespace miniplc0 {
+
+    //预先计算的输出的字节数的上限，常量的长度和个数都是 u2
+    static const size_t OutputLimit = 0xffff;
+
+    //在编译时以空的输入执行程序，最多执行 _evaluate_budget 条指令：
+    //  正常结束时，整个程序换成输出预先计算好的结果的 main；
+    //  否则（读取输入、出错或者超过预算）从最后一次记录的 main 中的状态继续执行：
+    //  启动代码换成压入全局变量的值，main 开头输出此前的结果、压入局部变量的值并跳到记录的位置。
+    //只在 main 的栈帧中栈上没有地址的指令之前记录状态，这时栈上的值都可以用常量重新压入
+    void Optimizer::evaluateProgram() {
+        if (_evaluate_budget <= 0)
+            return;
+        int32_t main = -1;
+        for (size_t i = 0; i < _functions._table.size(); i++)
+            if (_functions._table.at(i).GetName() == "main")
+                main = i;
+        if (main < 0 || _functions._table.at(main).GetParams() != 0)
+            return;
+        auto& mainCode = _function_body.at(main)._instruction;
+
+        Module module;
+        module._version = 1;
+        for (auto& it : _constants._table)
+            module._constants.emplace_back(it.GetName());
+        module._start = _start;
+        for (size_t i = 0; i < _function_body.size(); i++) {
+            auto& item = _functions._table.at(i);
+            module._functions.push_back({item.GetIndex(), item.GetParams(), 1, _function_body.at(i)._instruction});
+        }
+
+        //LOADA 压入的地址到被 ILOAD 或 ISTORE 使用之前不能记录状态，找不到使用地址的指令时不记录
+        std::vector<int32_t> depth;
+        std::vector<bool> points;
+        if (stackDepths(mainCode, 0, depth)) {
+            int32_t n = mainCode.size();
+            points.assign(n, true);
+            for (int32_t i = 0; i < n && !points.empty(); i++) {
+                if (depth.at(i) < 0)
+                    points.at(i) = false;
+                if (mainCode.at(i).GetOperation() != Operation::LOADA)
+                    continue;
+                int32_t use = i + 1 < n && mainCode.at(i + 1).GetOperation() == Operation::ILOAD ? i + 1 : matchingStore(mainCode, depth, i);
+                if (use < 0)
+                    points.clear();
+                else
+                    for (int32_t k = i + 1; k <= use; k++)
+                        points.at(k) = false;
+            }
+        }
+
+        VirtualMachine vm(module);
+        vm.SetStepLimit(_evaluate_budget);
+        vm.SetSnapshotPoints(points, OutputLimit);
+        std::istringstream input;
+        std::ostringstream output;
+        auto err = vm.Run(input, output);
+        auto text = output.str();
+
+        //逐行用 SPRINT 输出，相同的行共用常量
+        std::map<std::string, int32_t> lines;
+        auto print = [&](const std::string& text, std::vector<Instruction>& code) {
+            size_t begin = 0;
+            while (begin < text.size()) {
+                size_t end = text.find('\n', begin);
+                auto line = text.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+                if (!line.empty()) {
+                    if (!lines.count(line)) {
+                        lines[line] = _constants._table.size();
+                        _constants.addConstantItem(line, "S", _constants._table.size(), line);
+                    }
+                    code.emplace_back(Operation::LOADC, lines.at(line), 0);
+                    code.emplace_back(Operation::SPRINT, 0, 0);
+                }
+                if (end == std::string::npos)
+                    break;
+                code.emplace_back(Operation::PRINTL, 0, 0);
+                begin = end + 1;
+            }
+        };
+        auto push = [](int32_t value) {
+            return Instruction(value >= 0 && value <= 127 ? Operation::BIPUSH : Operation::IPUSH, value, 0);
+        };
+
+        if (!err.has_value() && text.size() <= OutputLimit) {
+            //只剩下 main，常量表只有 main 的名字和输出的行
+            auto item = _functions._table.at(main);
+            _constants._table.clear();
+            _constants.addConstantItem("main", "S", 0, "main");
+            std::vector<Instruction> code;
+            print(text, code);
+            if (item.GetType() == "INT") {
+                code.emplace_back(Operation::BIPUSH, 0, 0);
+                code.emplace_back(Operation::IRET, 0, 0);
+            }
+            else
+                code.emplace_back(Operation::RET, 0, 0);
+            _start.clear();
+            _functions._table.clear();
+            _functions._table.emplace_back("main", item.GetType(), 0, 0);
+            _function_body.clear();
+            _function_body.emplace_back(FunctionBody());
+            _function_body.back()._instruction = std::move(code);
+            return;
+        }
+
+        auto& snapshot = vm.GetSnapshot();
+        if (!snapshot.has_value())
+            return;
+        size_t globals = snapshot->_stack.size() - depth.at(snapshot->_pc);
+        std::vector<Instruction> prologue;
+        print(text.substr(0, snapshot->_output), prologue);
+        for (size_t i = globals; i < snapshot->_stack.size(); i++)
+            prologue.emplace_back(push(snapshot->_stack.at(i)));
+        //新增的指令比省下的指令多时不值得
+        if (prologue.size() + globals + 1 >= snapshot->_steps) {
+            _constants._table.erase(_constants._table.end() - lines.size(), _constants._table.end());
+            return;
+        }
+        prologue.emplace_back(Operation::JMP, snapshot->_pc + prologue.size() + 1, 0);
+        replaceInstructions(mainCode, 0, 0, prologue);
+        _start.clear();
+        for (size_t i = 0; i < globals; i++)
+            _start.emplace_back(push(snapshot->_stack.at(i)));
+    }
+}
@@ -0,0 +1,88 @@
+#include "optimizer.h"
+
+#include <climits>
+
+namespace miniplc0 {
+
+    //常量折叠，按 32 位补码计算：
+    //  PUSH a; PUSH b; op  ->  PUSH a op b      （除以 0 和 INT_MIN / -1 留到运行时）
+    //  PUSH a; INEG        ->  PUSH -a
+    //  PUSH c; Jcc L       ->  JMP L 或者删除
+    //  PUSH c; POP         ->  删除
+    //被折叠的指令中除第一条外不能是跳转目标，不可达的代码交给窥孔优化删除
+    bool Optimizer::foldConstants(std::vector<Instruction>& code) {
+        bool changed = false;
+        bool again = true;
+        while (again) {
+            again = false;
+            int32_t n = code.size();
+            std::vector<bool> isTarget(n + 1, false);
+            for (auto& it : code)
+                if (isJump(it.GetOperation()))
+                    isTarget.at(it.GetX()) = true;
+            auto isPush = [&](int32_t i) {
+                auto opr = code.at(i).GetOperation();
+                return opr == Operation::BIPUSH || opr == Operation::IPUSH;
+            };
+            auto push = [](int32_t value) {
+                return Instruction(value >= 0 && value <= 127 ? Operation::BIPUSH : Operation::IPUSH, value, 0);
+            };
+
+            std::vector<bool> removed(n, false);
+            for (int32_t i = 0; i + 1 < n; i++) {
+                if (!isPush(i) || isTarget.at(i + 1))
+                    continue;
+                auto a = (uint32_t)code.at(i).GetX();
+                auto opr = code.at(i + 1).GetOperation();
+                if (opr == Operation::INEG) {
+                    code.at(i) = push((int32_t)(0u - a));
+                    removed.at(i + 1) = true;
+                }
+                else if (opr == Operation::POP) {
+                    removed.at(i) = removed.at(i + 1) = true;
+                }
+                else if (isConditionalJump(opr)) {
+                    auto c = (int32_t)a;
+                    bool taken = (opr == Operation::JE && c == 0) || (opr == Operation::JNE && c != 0)
+                        || (opr == Operation::JL && c < 0) || (opr == Operation::JGE && c >= 0)
+                        || (opr == Operation::JG && c > 0) || (opr == Operation::JLE && c <= 0);
+                    if (taken) {
+                        code.at(i) = Instruction(Operation::JMP, code.at(i + 1).GetX(), 0);
+                        removed.at(i + 1) = true;
+                    }
+                    else
+                        removed.at(i) = removed.at(i + 1) = true;
+                }
+                else if (i + 2 < n && isPush(i + 1) && !isTarget.at(i + 2)) {
+                    auto b = (uint32_t)code.at(i + 1).GetX();
+                    opr = code.at(i + 2).GetOperation();
+                    uint32_t result;
+                    if (opr == Operation::IADD)
+                        result = a + b;
+                    else if (opr == Operation::ISUB)
+                        result = a - b;
+                    else if (opr == Operation::IMUL)
+                        result = a * b;
+                    else if (opr == Operation::IDIV && b != 0 && !((int32_t)a == INT_MIN && (int32_t)b == -1))
+                        result = (uint32_t)((int32_t)a / (int32_t)b);
+                    else
+                        continue;
+                    code.at(i) = push((int32_t)result);
+                    removed.at(i + 1) = removed.at(i + 2) = true;
+                }
+                else
+                    continue;
+                //同一轮中不重叠地折叠
+                again = true;
+                i += 1;
+                while (i + 1 < n && removed.at(i + 1))
+                    i++;
+            }
+            if (again) {
+                removeInstructions(code, removed);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+}
@@ -0,0 +1,68 @@
+#include "optimizer.h"
+
+#include <map>
+#include <tuple>
+
+namespace miniplc0 {
+
+    //合并代码相同的函数：
+    //  先按类型、参数个数和忽略 CALL 目标的指令序列划分等价类，
+    //  再按每条 CALL 的目标所在的等价类反复细分，直到等价类的个数不再变化。
+    //  这样互相递归调用的相同函数也能合并。
+    //每个等价类只保留下标最小的函数，调用其他函数的 CALL 改为调用它，函数名不再使用的常量被删除。
+    //main 的名字不能删除，不参与合并
+    void Optimizer::foldIdenticalFunctions() {
+        size_t n = _function_body.size();
+        std::vector<int32_t> classes(n, 0);
+        size_t count;
+        {
+            using Code = std::vector<std::tuple<Operation, int32_t, int32_t>>;
+            std::map<std::tuple<bool, std::string, int32_t, Code>, int32_t> initial;
+            for (size_t i = 0; i < n; i++) {
+                auto& function = _functions._table.at(i);
+                Code code;
+                for (auto& it : _function_body.at(i)._instruction) {
+                    auto opr = it.GetOperation();
+                    //读入的 o0 文件中可能有无效的调用，这时不做合并
+                    if (opr == Operation::CALL && (it.GetX() < 0 || it.GetX() >= (int32_t)n))
+                        return;
+                    code.emplace_back(opr, opr == Operation::CALL ? 0 : it.GetX(), it.GetY());
+                }
+                auto key = std::make_tuple(function.GetName() == "main", function.GetType(), function.GetParams(), std::move(code));
+                classes.at(i) = initial.emplace(std::move(key), initial.size()).first->second;
+            }
+            count = initial.size();
+            if (count == n)
+                return;
+        }
+
+        //旧的等价类和 CALL 目标所在的等价类都相同的函数仍然等价
+        while (true) {
+            std::map<std::pair<int32_t, std::vector<int32_t>>, int32_t> refined;
+            std::vector<int32_t> next(n);
+            for (size_t i = 0; i < n; i++) {
+                std::vector<int32_t> callees;
+                for (auto& it : _function_body.at(i)._instruction)
+                    if (it.GetOperation() == Operation::CALL)
+                        callees.emplace_back(classes.at(it.GetX()));
+                next.at(i) = refined.emplace(std::make_pair(classes.at(i), std::move(callees)), refined.size()).first->second;
+            }
+            classes = std::move(next);
+            if (refined.size() == count || refined.size() == n)
+                break;
+            count = refined.size();
+        }
+
+        std::vector<int32_t> survivor(n, -1);
+        std::vector<bool> keep(n, false);
+        std::vector<int32_t> mapping(n, -1);
+        for (size_t i = 0; i < n; i++) {
+            auto& first = survivor.at(classes.at(i));
+            if (first < 0)
+                first = i;
+            keep.at(i) = first == (int32_t)i;
+            mapping.at(i) = first;
+        }
+        renumberFunctions(keep, mapping);
+    }
+}
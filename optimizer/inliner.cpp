@@ -0,0 +1,189 @@
+#include "optimizer.h"
+
+#include <algorithm>
+
+namespace miniplc0 {
+
+    //自底向上处理调用图，被调用者先完成内联，再作为整体被内联到调用者中
+    void Optimizer::inlineFunctions() {
+        if (_inline_budget <= 0)
+            return;
+        std::vector<bool> recursive;
+        auto components = callGraphComponents(recursive);
+
+        for (auto& component : components) {
+            for (auto caller : component) {
+                auto& code = _function_body.at(caller)._instruction;
+                //限制调用者的膨胀
+                size_t limit = code.size() + 8 * _inline_budget;
+                int32_t i = 0;
+                while (i < (int32_t)_function_body.at(caller)._instruction.size()) {
+                    auto& it = _function_body.at(caller)._instruction.at(i);
+                    int32_t next;
+                    if (it.GetOperation() == Operation::CALL && it.GetX() != caller && !recursive.at(it.GetX())
+                        && inlineCallSite(caller, i, limit, next))
+                        i = next;
+                    else
+                        i++;
+                }
+            }
+        }
+    }
+
+    //调用处的栈：| 调用者的局部变量和临时值 | 参数0 ... 参数n-1 |
+    //                                    ^ base
+    //内联后被调用者的栈帧直接从 base 开始，LOADA 0,off 改为 LOADA 0,base+off。
+    //只被读取的参数，如果实参是常量或者单个变量，就不再压栈，而是在读取处直接替换成实参。
+    //返回指令改为把返回值移动到 base 处，弹出其余的值，再跳转到调用之后。
+    bool Optimizer::inlineCallSite(int32_t caller, int32_t call, size_t limit, int32_t& next) {
+        auto& code = _function_body.at(caller)._instruction;
+        int32_t callee = code.at(call).GetX();
+        auto& body = _function_body.at(callee)._instruction;
+        int32_t params = _functions._table.at(callee).GetParams();
+
+        //代价模型：被调用者的指令数不超过预算，循环每深一层预算翻倍；
+        //有执行计数时冷的调用点不内联，热的调用点使用最大的预算
+        int32_t hotness = callHotness(caller, callee);
+        if (hotness < 0)
+            return false;
+        int32_t budget = _inline_budget << (hotness > 0 ? 3 : std::min(loopDepth(code, call), 3));
+        if ((int32_t)body.size() > budget || code.size() + body.size() > limit)
+            return false;
+
+        std::vector<int32_t> depth, calleeDepth;
+        if (!stackDepths(code, _functions._table.at(caller).GetParams(), depth) || depth.at(call) < params)
+            return false;
+        if (!stackDepths(body, params, calleeDepth))
+            return false;
+        int32_t base = depth.at(call) - params;
+
+        std::vector<int32_t> argStart;
+        if (!argumentStarts(code, depth, call, params, argStart))
+            return false;
+
+        //被调用者中哪些参数被写过，是否可能修改全局变量
+        std::vector<bool> isTarget(body.size() + 1, false);
+        for (auto& it : body)
+            if (isJump(it.GetOperation()))
+                isTarget.at(it.GetX()) = true;
+        std::vector<bool> written(params, false);
+        bool touchesGlobals = false;
+        for (size_t r = 0; r < body.size(); r++) {
+            auto& it = body.at(r);
+            if (it.GetOperation() == Operation::CALL)
+                touchesGlobals = true;
+            if (it.GetOperation() != Operation::LOADA)
+                continue;
+            bool read = r + 1 < body.size() && body.at(r + 1).GetOperation() == Operation::ILOAD && !isTarget.at(r + 1);
+            if (read)
+                continue;
+            if (it.GetX() == 1)
+                touchesGlobals = true;
+            else if (it.GetY() < params)
+                written.at(it.GetY()) = true;
+        }
+
+        //可以直接替换的实参
+        std::vector<bool> substituted(params, false);
+        int32_t kept = 0;
+        std::vector<int32_t> keptBefore(params, 0);
+        for (int32_t k = 0; k < params; k++) {
+            keptBefore.at(k) = kept;
+            int32_t from = argStart.at(k), to = argStart.at(k + 1);
+            auto first = code.at(from).GetOperation();
+            bool constant = to - from == 1 && (first == Operation::IPUSH || first == Operation::BIPUSH);
+            bool variable = to - from == 2 && first == Operation::LOADA && code.at(from + 1).GetOperation() == Operation::ILOAD;
+            if (variable && code.at(from).GetX() == 1) {
+                //全局变量不能在实参求值之后被修改
+                if (touchesGlobals)
+                    variable = false;
+                for (int32_t j = to; j < call; j++)
+                    if (code.at(j).GetOperation() == Operation::CALL)
+                        variable = false;
+            }
+            substituted.at(k) = !written.at(k) && (constant || variable);
+            if (!substituted.at(k))
+                kept++;
+        }
+        int32_t removedParams = params - kept;
+        auto newSlot = [&](int32_t off) {
+            if (off < params)
+                return base + keptBefore.at(off);
+            return base + kept + (off - params);
+        };
+
+        std::vector<Instruction> inlined;
+        for (int32_t k = 0; k < params; k++)
+            if (!substituted.at(k))
+                inlined.insert(inlined.end(), code.begin() + argStart.at(k), code.begin() + argStart.at(k + 1));
+
+        std::vector<int32_t> position(body.size() + 1, 0);
+        std::vector<size_t> bodyJumps, exitJumps;
+        for (size_t r = 0; r < body.size(); r++) {
+            position.at(r) = inlined.size();
+            auto it = body.at(r);
+            auto opr = it.GetOperation();
+            if (opr == Operation::LOADA && it.GetX() == 0) {
+                int32_t off = it.GetY();
+                if (off < params && substituted.at(off)) {
+                    //只读的参数，LOADA 0,off; ILOAD 替换为实参
+                    inlined.insert(inlined.end(), code.begin() + argStart.at(off), code.begin() + argStart.at(off + 1));
+                    r++;
+                    position.at(r) = inlined.size();
+                    continue;
+                }
+                it.SetY(newSlot(off));
+            }
+            else if (isJump(opr))
+                bodyJumps.emplace_back(inlined.size());
+            else if (opr == Operation::IRET || opr == Operation::RET) {
+                if (calleeDepth.at(r) < 0)
+                    return false;
+                int32_t height = calleeDepth.at(r) - removedParams;
+                //返回值是读取 base 处的变量时，值已经在 base 处，只需弹出其余的部分
+                bool atBase = opr == Operation::IRET && height > 1 && r >= 2 && inlined.size() >= 2
+                    && inlined.at(inlined.size() - 2).GetOperation() == Operation::LOADA
+                    && inlined.at(inlined.size() - 2).GetX() == 0 && inlined.at(inlined.size() - 2).GetY() == base
+                    && inlined.back().GetOperation() == Operation::ILOAD
+                    && std::none_of(body.begin(), body.end(), [r](const Instruction& x) {
+                        return isJump(x.GetOperation()) && (x.GetX() == (int32_t)r - 1 || x.GetX() == (int32_t)r);
+                    });
+                if (atBase) {
+                    inlined.pop_back();
+                    inlined.pop_back();
+                    if (height > 2)
+                        inlined.emplace_back(Operation::POPN, height - 2, 0);
+                }
+                else if (opr == Operation::IRET && height > 1) {
+                    inlined.emplace_back(Operation::LOADA, 0, base);
+                    inlined.emplace_back(Operation::LOADA, 0, base + height - 1);
+                    inlined.emplace_back(Operation::ILOAD, 0, 0);
+                    inlined.emplace_back(Operation::ISTORE, 0, 0);
+                    inlined.emplace_back(Operation::POPN, height - 1, 0);
+                }
+                else if (opr == Operation::RET && height > 0)
+                    inlined.emplace_back(Operation::POPN, height, 0);
+                exitJumps.emplace_back(inlined.size());
+                inlined.emplace_back(Operation::JMP, 0, 0);
+                continue;
+            }
+            inlined.emplace_back(it);
+        }
+        position.at(body.size()) = inlined.size();
+        for (auto j : bodyJumps)
+            inlined.at(j).SetX(position.at(inlined.at(j).GetX()));
+        for (auto j : exitJumps)
+            inlined.at(j).SetX(inlined.size());
+
+        auto backup = code;
+        replaceInstructions(code, argStart.at(0), call + 1, inlined);
+        //内联后栈高度必须仍然一致
+        std::vector<int32_t> check;
+        if (!stackDepths(code, _functions._table.at(caller).GetParams(), check)) {
+            code.swap(backup);
+            return false;
+        }
+        next = argStart.at(0) + inlined.size();
+        return true;
+    }
+}
@@ -0,0 +1,220 @@
+#include "optimizer.h"
+
+#include <algorithm>
+
+namespace miniplc0 {
+
+    //向后的跳转 e -> h 确定循环 [h, e]，从最小的循环开始处理，每次外提后重新找循环
+    void Optimizer::hoistLoopInvariants(int32_t function) {
+        auto& code = _function_body.at(function)._instruction;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            std::vector<std::pair<int32_t, int32_t>> loops;
+            for (int32_t i = 0; i < (int32_t)code.size(); i++)
+                if (isJump(code.at(i).GetOperation()) && code.at(i).GetX() <= i)
+                    loops.emplace_back(code.at(i).GetX(), i);
+            std::sort(loops.begin(), loops.end(), [](const std::pair<int32_t, int32_t>& a, const std::pair<int32_t, int32_t>& b) {
+                return a.second - a.first < b.second - b.first;
+            });
+            for (auto& it : loops) {
+                if (hoistLoop(function, it.first, it.second)) {
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    //循环中不变的纯表达式移到循环之前，结果存到新的槽中，循环中改为读取这个槽：
+    //  LOADA 0,t; <表达式>; ISTORE      （放在 h 之前，从循环外进入 h 的跳转改为跳到这里）
+    //  h: ... LOADA 0,t; ILOAD ...
+    //不变的读取：循环中没有写入的局部变量；循环中没有调用时，没有写入的全局变量。
+    //除法只有除数是非 0 且非 -1 的常量时才外提，外提的代码即使循环体一次都不执行也不会出错。
+    //新的槽放在参数之后，其余的槽依次后移，入口的 SNEW 相应增大。
+    bool Optimizer::hoistLoop(int32_t function, int32_t h, int32_t e) {
+        auto& code = _function_body.at(function)._instruction;
+        int32_t params = _functions._table.at(function).GetParams();
+        int32_t n = code.size();
+        std::vector<int32_t> depth;
+        if (!stackDepths(code, params, depth) || depth.at(h) < 0)
+            return false;
+        //只能从 h 进入循环
+        for (int32_t i = 0; i < n; i++)
+            if ((i < h || i > e) && isJump(code.at(i).GetOperation()) && code.at(i).GetX() > h && code.at(i).GetX() <= e)
+                return false;
+
+        //循环中写入的地址和是否有调用
+        std::vector<std::pair<int32_t, int32_t>> stored;
+        bool hasCall = false;
+        for (int32_t i = h; i <= e; i++) {
+            auto& it = code.at(i);
+            if (it.GetOperation() == Operation::CALL)
+                hasCall = true;
+            if (it.GetOperation() == Operation::LOADA && (i + 1 > e || code.at(i + 1).GetOperation() != Operation::ILOAD))
+                stored.emplace_back(it.GetX(), it.GetY());
+        }
+        auto isStored = [&](int32_t x, int32_t y) {
+            return std::find(stored.begin(), stored.end(), std::make_pair(x, y)) != stored.end();
+        };
+        //循环开始时栈上只有参数和局部变量
+        int32_t locals = depth.at(h);
+
+        std::vector<bool> leader(n + 1, false);
+        leader.at(h) = true;
+        for (int32_t i = 0; i < n; i++) {
+            auto opr = code.at(i).GetOperation();
+            if (isJump(opr))
+                leader.at(code.at(i).GetX()) = true;
+            if (isJump(opr) || isReturn(opr))
+                leader.at(i + 1) = true;
+        }
+
+        struct Entry {
+            int32_t from;
+            bool invariant;
+            //是否为常量及其值，用于判断除法
+            bool constant;
+            int32_t value;
+            //LOADA 压入的地址
+            int32_t x, y;
+        };
+        std::vector<std::pair<int32_t, int32_t>> candidates;
+        for (int32_t b = h; b <= e; b++) {
+            if (!leader.at(b) || depth.at(b) < 0)
+                continue;
+            std::vector<Entry> stack;
+            auto pop = [&]() {
+                Entry entry{-1, false, false, 0, -1, -1};
+                if (!stack.empty()) {
+                    entry = stack.back();
+                    stack.pop_back();
+                }
+                return entry;
+            };
+            auto produce = [&](Entry entry, int32_t to) {
+                stack.emplace_back(entry);
+                if (entry.invariant && to - entry.from + 1 >= 3)
+                    candidates.emplace_back(entry.from, to);
+            };
+            for (int32_t i = b; i <= e && (i == b || !leader.at(i)); i++) {
+                auto& it = code.at(i);
+                auto opr = it.GetOperation();
+                switch (opr) {
+                    case Operation::BIPUSH:
+                    case Operation::IPUSH:
+                        stack.push_back({i, true, true, it.GetX(), -1, -1});
+                        break;
+                    case Operation::LOADA:
+                        stack.push_back({i, false, false, 0, it.GetX(), it.GetY()});
+                        break;
+                    case Operation::ILOAD: {
+                        auto address = pop();
+                        bool invariant = address.from == i - 1 && !isStored(address.x, address.y)
+                            && ((address.x == 0 && address.y < locals) || (address.x == 1 && !hasCall));
+                        stack.push_back({address.from, invariant, false, 0, -1, -1});
+                        break;
+                    }
+                    case Operation::IADD:
+                    case Operation::ISUB:
+                    case Operation::IMUL:
+                    case Operation::IDIV: {
+                        auto rhs = pop();
+                        auto lhs = pop();
+                        bool invariant = lhs.invariant && rhs.invariant;
+                        if (opr == Operation::IDIV && !(rhs.constant && rhs.value != 0 && rhs.value != -1))
+                            invariant = false;
+                        produce({lhs.from, invariant, false, 0, -1, -1}, i);
+                        break;
+                    }
+                    case Operation::INEG: {
+                        auto operand = pop();
+                        produce({operand.from, operand.invariant, false, 0, -1, -1}, i);
+                        break;
+                    }
+                    //弹出和压入的个数不能只看净效果，调用可能有副作用，结果都不是不变量
+                    case Operation::CALL: {
+                        auto& function = _functions._table.at(it.GetX());
+                        for (int32_t k = 0; k < function.GetParams(); k++)
+                            pop();
+                        if (function.GetType() == "INT")
+                            stack.push_back({i, false, false, 0, -1, -1});
+                        break;
+                    }
+                    case Operation::ICMP:
+                    case Operation::I2C: {
+                        pop();
+                        if (opr == Operation::ICMP)
+                            pop();
+                        stack.push_back({i, false, false, 0, -1, -1});
+                        break;
+                    }
+                    default: {
+                        int32_t effect = isReturn(opr) ? 0 : stackEffect(it);
+                        for (int32_t k = 0; k < -effect; k++)
+                            pop();
+                        for (int32_t k = 0; k < effect; k++)
+                            stack.push_back({i, false, false, 0, -1, -1});
+                        break;
+                    }
+                }
+            }
+        }
+        if (candidates.empty())
+            return false;
+
+        //取最外层的表达式，相同的表达式共用一个槽
+        std::sort(candidates.begin(), candidates.end(), [](const std::pair<int32_t, int32_t>& a, const std::pair<int32_t, int32_t>& b) {
+            return a.first != b.first ? a.first < b.first : a.second > b.second;
+        });
+        std::vector<std::pair<int32_t, int32_t>> chosen;
+        for (auto& it : candidates)
+            if (chosen.empty() || it.first > chosen.back().second)
+                chosen.emplace_back(it);
+
+        //新的槽为 params, params+1, ...，其余的槽后移
+        std::vector<std::vector<Instruction>> expressions;
+        std::vector<int32_t> slot;
+        for (auto& it : chosen) {
+            std::vector<Instruction> expression(code.begin() + it.first, code.begin() + it.second + 1);
+            auto found = std::find(expressions.begin(), expressions.end(), expression);
+            slot.emplace_back(params + (found - expressions.begin()));
+            if (found == expressions.end())
+                expressions.emplace_back(expression);
+        }
+        int32_t added = expressions.size();
+        auto shift = [&](std::vector<Instruction>& instructions) {
+            for (auto& it : instructions)
+                if (it.GetOperation() == Operation::LOADA && it.GetX() == 0 && it.GetY() >= params)
+                    it.SetY(it.GetY() + added);
+        };
+        shift(code);
+
+        std::vector<Instruction> preheader;
+        for (int32_t k = 0; k < added; k++) {
+            shift(expressions.at(k));
+            preheader.emplace_back(Operation::LOADA, 0, params + k);
+            preheader.insert(preheader.end(), expressions.at(k).begin(), expressions.at(k).end());
+            preheader.emplace_back(Operation::ISTORE, 0, 0);
+        }
+        int32_t end = e + 1;
+        for (int32_t k = chosen.size() - 1; k >= 0; k--) {
+            replaceInstructions(code, chosen.at(k).first, chosen.at(k).second + 1,
+                                {Instruction(Operation::LOADA, 0, slot.at(k)), Instruction(Operation::ILOAD, 0, 0)});
+            end -= chosen.at(k).second + 1 - chosen.at(k).first - 2;
+        }
+
+        //循环外跳到 h 的跳转改为跳到外提的代码
+        replaceInstructions(code, h, h, preheader);
+        int32_t length = preheader.size();
+        for (int32_t i = 0; i < (int32_t)code.size(); i++)
+            if ((i < h || i >= end + length) && isJump(code.at(i).GetOperation()) && code.at(i).GetX() == h + length)
+                code.at(i).SetX(h);
+
+        if (!code.empty() && code.at(0).GetOperation() == Operation::SNEW)
+            code.at(0).SetX(code.at(0).GetX() + added);
+        else
+            replaceInstructions(code, 0, 0, {Instruction(Operation::SNEW, added, 0)});
+        return true;
+    }
+}
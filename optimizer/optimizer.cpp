@@ -0,0 +1,769 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+namespace miniplc0 {
+
+    //-O1：不改变函数和循环结构的局部优化
+    //-O2：再加上编译时执行、删除死函数、循环不变量外提、尾调用消除、内联和合并相同的函数
+    std::vector<OptimizationStatistics> Optimizer::Optimize(int32_t level, size_t jobs) {
+        _statistics.clear();
+        _pass_statistics.clear();
+        if (level <= 0)
+            return _statistics;
+
+        //函数名到统计项的下标，函数可能被删除或重新编号
+        std::map<std::string, size_t> position;
+        _statistics.push_back({".start", _start.size(), 0, codeSize(_start), 0, false, 0});
+        for (size_t i = 0; i < _function_body.size(); i++) {
+            auto& code = _function_body.at(i)._instruction;
+            position[_functions._table.at(i).GetName()] = _statistics.size();
+            _statistics.push_back({_functions._table.at(i).GetName(), code.size(), 0, codeSize(code), 0, true, 0});
+        }
+
+        //新增的函数（特化的克隆）加入统计
+        auto track = [this, &position]() {
+            for (size_t i = 0; i < _function_body.size(); i++) {
+                auto name = _functions._table.at(i).GetName();
+                if (position.count(name))
+                    continue;
+                position[name] = _statistics.size();
+                _statistics.push_back({name, 0, 0, 0, 0, true, 0});
+            }
+        };
+
+        PassManager manager(_start, _function_body, jobs);
+        auto peepholeFunction = [this](int32_t i) { while (peephole(_function_body.at(i)._instruction)); };
+        auto foldFunction = [this](int32_t i) {
+            auto& code = _function_body.at(i)._instruction;
+            bool changed = false;
+            while (foldConstants(code) | simplifyAlgebra(code))
+                changed = true;
+            if (changed)
+                while (peephole(code));
+        };
+        //程序不依赖输入的部分在编译时执行，剩下的代码再做其他优化
+        if (level >= 2)
+            manager.addModulePass("evaluate", [this]() { evaluateProgram(); });
+        //执行计数按原始代码的下标记录，要在其他优化之前使用
+        if (_profile != nullptr) {
+            manager.addModulePass("profile", [this]() { readProfile(); });
+            manager.addFunctionPass("layout", [this](int32_t i) { layoutFunction(i); });
+        }
+        if (level >= 2)
+            manager.addModulePass("dead-functions", [this]() { eliminateDeadFunctions(); });
+        manager.addModulePass("allocate-globals", [this]() { allocateGlobals(); });
+        manager.addFunctionPass("allocate-slots", [this](int32_t i) { allocateSlots(i); });
+        manager.addFunctionPass("peephole", peepholeFunction);
+        manager.addFunctionPass("fold", foldFunction);
+        if (level >= 2) {
+            manager.addModulePass("specialize", [this, &track]() {
+                specializeFunctions();
+                track();
+            });
+            manager.addFunctionPass("licm", [this](int32_t i) { hoistLoopInvariants(i); });
+            manager.addFunctionPass("tail-calls", [this](int32_t i) { eliminateTailCalls(i); });
+            manager.addModulePass("inline", [this]() { inlineFunctions(); });
+            manager.addModulePass("dead-functions", [this]() { eliminateDeadFunctions(); });
+            //内联代入的常量实参可以继续化简，先删除内联留下的跳转
+            manager.addFunctionPass("fold", [&peepholeFunction, &foldFunction](int32_t i) {
+                peepholeFunction(i);
+                foldFunction(i);
+            });
+        }
+        manager.addModulePass("cse-start", [this]() { eliminateCommonSubexpressions(_start, 0, true); });
+        manager.addFunctionPass("cse", [this](int32_t i) {
+            eliminateCommonSubexpressions(_function_body.at(i)._instruction, _functions._table.at(i).GetParams(), false);
+        });
+        manager.addModulePass("peephole-start", [this]() { while (peephole(_start)); });
+        manager.addFunctionPass("peephole", peepholeFunction);
+        //内联留下的跳转被窥孔优化删除之后再做死存储消除
+        //每个函数只写自己的统计项，可以并行
+        manager.addFunctionPass("dse", [this, &position](int32_t i) {
+            size_t removed = eliminateDeadStores(i);
+            _statistics.at(position.at(_functions._table.at(i).GetName()))._dead_store_instructions += removed;
+            if (removed > 0)
+                while (peephole(_function_body.at(i)._instruction));
+        });
+        manager.addFunctionPass("strength", [this](int32_t i) { reduceStrength(_function_body.at(i)._instruction); });
+        //新增的常量要按顺序编号，不能按函数并行
+        manager.addModulePass("prints", [this]() { fusePrints(); });
+        //其他优化之后代码相同的函数只保留一个
+        if (level >= 2)
+            manager.addModulePass("identical-functions", [this]() { foldIdenticalFunctions(); });
+        _pass_statistics = manager.run();
+
+        _statistics.at(0)._instructions_after = _start.size();
+        _statistics.at(0)._bytes_after = codeSize(_start);
+        for (size_t i = 0; i < _function_body.size(); i++) {
+            auto& stat = _statistics.at(position.at(_functions._table.at(i).GetName()));
+            auto& code = _function_body.at(i)._instruction;
+            stat._instructions_after = code.size();
+            stat._bytes_after = codeSize(code);
+            stat._removed = false;
+        }
+        return _statistics;
+    }
+
+    //已经编译好的 o0 文件不一定由本编译器生成，只做不依赖代码生成方式的删除死函数、窥孔优化、合并相同的函数和删除无用的常量，
+    //代码中可以有超级指令
+    void Optimizer::OptimizeBinary(size_t jobs) {
+        _pass_statistics.clear();
+        PassManager manager(_start, _function_body, jobs);
+        //没有 main 时不知道哪些函数会被调用
+        bool hasMain = std::any_of(_functions._table.begin(), _functions._table.end(),
+                                   [](const Tableitem& it) { return it.GetName() == "main"; });
+        if (hasMain)
+            manager.addModulePass("dead-functions", [this]() { eliminateDeadFunctions(); });
+        manager.addModulePass("peephole-start", [this]() { while (peephole(_start)); });
+        manager.addFunctionPass("peephole", [this](int32_t i) { while (peephole(_function_body.at(i)._instruction)); });
+        manager.addModulePass("identical-functions", [this]() { foldIdenticalFunctions(); });
+        manager.addModulePass("constants", [this]() { removeUnusedConstants(); });
+        _pass_statistics = manager.run();
+    }
+
+    //从 main 和启动代码中的 CALL 出发，沿 CALL 指令遍历调用图
+    void Optimizer::eliminateDeadFunctions() {
+        std::vector<bool> keep(_function_body.size(), false);
+        std::vector<int32_t> worklist;
+        auto mark = [&](int32_t index) {
+            if (index >= 0 && index < (int32_t)keep.size() && !keep.at(index)) {
+                keep.at(index) = true;
+                worklist.emplace_back(index);
+            }
+        };
+
+        for (size_t i = 0; i < _functions._table.size(); i++)
+            if (_functions._table.at(i).GetName() == "main")
+                mark(i);
+        for (auto& it : _start)
+            if (it.GetOperation() == Operation::CALL)
+                mark(it.GetX());
+        while (!worklist.empty()) {
+            int32_t index = worklist.back();
+            worklist.pop_back();
+            for (auto& it : _function_body.at(index)._instruction)
+                if (it.GetOperation() == Operation::CALL)
+                    mark(it.GetX());
+        }
+
+        renumberFunctions(keep, std::vector<int32_t>(keep.size(), -1));
+    }
+
+    void Optimizer::renumberFunctions(const std::vector<bool>& keep, const std::vector<int32_t>& mapping) {
+        //新的函数下标
+        std::vector<int32_t> newIndex(keep.size(), -1);
+        int32_t count = 0;
+        for (size_t i = 0; i < keep.size(); i++)
+            if (keep.at(i))
+                newIndex.at(i) = count++;
+        for (size_t i = 0; i < keep.size(); i++)
+            if (!keep.at(i) && mapping.at(i) >= 0)
+                newIndex.at(i) = newIndex.at(mapping.at(i));
+        if (count == (int32_t)keep.size())
+            return;
+
+        auto renumberCalls = [&](std::vector<Instruction>& code) {
+            for (auto& it : code)
+                if (it.GetOperation() == Operation::CALL)
+                    it.SetX(newIndex.at(it.GetX()));
+        };
+
+        std::vector<Tableitem> functions;
+        std::vector<FunctionBody> bodies;
+        for (size_t i = 0; i < keep.size(); i++) {
+            if (!keep.at(i))
+                continue;
+            functions.emplace_back(_functions._table.at(i));
+            bodies.emplace_back(std::move(_function_body.at(i)));
+            renumberCalls(bodies.back()._instruction);
+        }
+        renumberCalls(_start);
+        _functions._table = std::move(functions);
+        _function_body = std::move(bodies);
+        removeUnusedConstants();
+    }
+
+    //常量表中只保留仍被函数名或 LOADC 引用的常量
+    void Optimizer::removeUnusedConstants() {
+        std::vector<bool> used(_constants._table.size(), false);
+        for (auto& it : _functions._table)
+            used.at(it.GetIndex()) = true;
+        auto markLoadc = [&](const std::vector<Instruction>& code) {
+            for (auto& it : code)
+                if (it.GetOperation() == Operation::LOADC)
+                    used.at(it.GetX()) = true;
+        };
+        markLoadc(_start);
+        for (auto& it : _function_body)
+            markLoadc(it._instruction);
+
+        std::vector<int32_t> newConstant(_constants._table.size(), -1);
+        std::vector<Tableitem> constants;
+        for (size_t i = 0; i < _constants._table.size(); i++) {
+            if (!used.at(i))
+                continue;
+            newConstant.at(i) = constants.size();
+            constants.emplace_back(_constants._table.at(i));
+        }
+        auto renumberLoadc = [&](std::vector<Instruction>& code) {
+            for (auto& it : code)
+                if (it.GetOperation() == Operation::LOADC)
+                    it.SetX(newConstant.at(it.GetX()));
+        };
+        renumberLoadc(_start);
+        for (auto& it : _function_body)
+            renumberLoadc(it._instruction);
+        for (auto& it : _functions._table)
+            it = Tableitem(it.GetName(), it.GetType(), newConstant.at(it.GetIndex()), it.GetParams());
+        _constants._table = std::move(constants);
+    }
+
+    //return f(...); 在 f 自身中编译为 CALL f; IRET（void 函数为 CALL f; RET）
+    //改为把实参写回参数的位置，弹出局部变量，再跳回函数入口。
+    //实参中没有调用时可以调整求值顺序，尽量直接写入参数：
+    //  LOADA 0,i; <实参 i>; ISTORE
+    //只要之后求值的实参不再读取参数 i。互相读取的实参先压栈，最后再写回：
+    //  LOADA 0,i; LOADA 0,base+t; ILOAD; ISTORE
+    //  POPN 栈高度-params
+    //  JMP 0
+    //实参就是参数自身（LOADA 0,i; ILOAD）时不需要写回
+    void Optimizer::eliminateTailCalls(int32_t function) {
+        auto& code = _function_body.at(function)._instruction;
+        int32_t params = _functions._table.at(function).GetParams();
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            std::vector<int32_t> depth;
+            if (!stackDepths(code, params, depth))
+                return;
+            for (int32_t call = 0; call + 1 < (int32_t)code.size(); call++) {
+                if (code.at(call).GetOperation() != Operation::CALL || code.at(call).GetX() != function
+                    || !isReturn(code.at(call + 1).GetOperation()) || depth.at(call) < 0)
+                    continue;
+                int32_t base = depth.at(call) - params;
+                std::vector<int32_t> argStart;
+                bool split = argumentStarts(code, depth, call, params, argStart);
+                int32_t from = split ? argStart.at(0) : call;
+                //实参中间有跳转目标或者调用时不能重排
+                for (auto& it : code)
+                    if (split && isJump(it.GetOperation()) && it.GetX() > from && it.GetX() <= call)
+                        split = false;
+                for (int32_t j = from; split && j < call; j++)
+                    if (code.at(j).GetOperation() == Operation::CALL)
+                        split = false;
+                if (!split)
+                    from = call;
+
+                auto identity = [&](int32_t i) {
+                    return argStart.at(i + 1) - argStart.at(i) == 2 && code.at(argStart.at(i)) == Instruction(Operation::LOADA, 0, i)
+                        && code.at(argStart.at(i) + 1).GetOperation() == Operation::ILOAD;
+                };
+                auto reads = [&](int32_t i, int32_t k) {
+                    for (int32_t j = argStart.at(i); j < argStart.at(i + 1); j++)
+                        if (code.at(j) == Instruction(Operation::LOADA, 0, k))
+                            return true;
+                    return false;
+                };
+
+                //inPlace 为直接写入的实参的顺序，stacked 为先压栈的实参
+                std::vector<int32_t> inPlace, stacked;
+                if (split) {
+                    std::vector<int32_t> remaining;
+                    for (int32_t i = 0; i < params; i++)
+                        if (!identity(i))
+                            remaining.emplace_back(i);
+                    while (!remaining.empty()) {
+                        bool found = false;
+                        for (size_t r = 0; r < remaining.size() && !found; r++) {
+                            int32_t k = remaining.at(r);
+                            bool free = true;
+                            for (auto i : remaining)
+                                if (i != k && reads(i, k))
+                                    free = false;
+                            if (free) {
+                                inPlace.emplace_back(k);
+                                remaining.erase(remaining.begin() + r);
+                                found = true;
+                            }
+                        }
+                        //互相依赖时把第一个压栈
+                        if (!found) {
+                            stacked.emplace_back(remaining.front());
+                            remaining.erase(remaining.begin());
+                        }
+                    }
+                    std::sort(stacked.begin(), stacked.end());
+                }
+
+                std::vector<Instruction> replacement;
+                int32_t top = split ? base + stacked.size() : depth.at(call);
+                for (auto i : stacked)
+                    replacement.insert(replacement.end(), code.begin() + argStart.at(i), code.begin() + argStart.at(i + 1));
+                for (auto i : inPlace) {
+                    replacement.emplace_back(Operation::LOADA, 0, i);
+                    replacement.insert(replacement.end(), code.begin() + argStart.at(i), code.begin() + argStart.at(i + 1));
+                    replacement.emplace_back(Operation::ISTORE, 0, 0);
+                }
+                if (split) {
+                    for (size_t t = 0; t < stacked.size(); t++) {
+                        replacement.emplace_back(Operation::LOADA, 0, stacked.at(t));
+                        replacement.emplace_back(Operation::LOADA, 0, base + t);
+                        replacement.emplace_back(Operation::ILOAD, 0, 0);
+                        replacement.emplace_back(Operation::ISTORE, 0, 0);
+                    }
+                }
+                else {
+                    for (int32_t i = 0; i < params; i++) {
+                        replacement.emplace_back(Operation::LOADA, 0, i);
+                        replacement.emplace_back(Operation::LOADA, 0, base + i);
+                        replacement.emplace_back(Operation::ILOAD, 0, 0);
+                        replacement.emplace_back(Operation::ISTORE, 0, 0);
+                    }
+                }
+                if (top > params)
+                    replacement.emplace_back(Operation::POPN, top - params, 0);
+                //replacement 中的跳转目标相对于 from，入口为 -from
+                replacement.emplace_back(Operation::JMP, -from, 0);
+                replaceInstructions(code, from, call + 1, replacement);
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    //窥孔优化：
+    //  小常量 IPUSH -> BIPUSH
+    //  跳转到 JMP 的跳转直接跳到最终目标，跳转到返回指令的 JMP 直接返回
+    //  Jcc L; JMP M; L:  ->  J!cc M
+    //  跳转到下一条指令的 JMP 删除，Jcc 换成 POP
+    //  删除不可达的指令
+    bool Optimizer::peephole(std::vector<Instruction>& code) {
+        bool changed = false;
+        int32_t n = code.size();
+
+        //BIPUSH 只有一个字节的操作数，只替换 [0,127] 保证有无符号扩展都正确
+        for (auto& it : code) {
+            if (it.GetOperation() == Operation::IPUSH && it.GetX() >= 0 && it.GetX() <= 127) {
+                it = Instruction(Operation::BIPUSH, it.GetX(), 0);
+                changed = true;
+            }
+        }
+
+        for (int32_t i = 0; i < n; i++) {
+            auto opr = code.at(i).GetOperation();
+            if (!isJump(opr))
+                continue;
+            int32_t target = finalTarget(code, code.at(i).GetX());
+            if (target != code.at(i).GetX()) {
+                code.at(i).SetX(target);
+                changed = true;
+            }
+            if (opr == Operation::JMP && target < n && isReturn(code.at(target).GetOperation())) {
+                code.at(i) = code.at(target);
+                changed = true;
+            }
+        }
+
+        std::vector<bool> isTarget(n + 1, false);
+        for (auto& it : code)
+            if (isJump(it.GetOperation()))
+                isTarget.at(it.GetX()) = true;
+        for (int32_t i = 0; i + 1 < n; i++) {
+            auto& jcond = code.at(i);
+            auto& jmp = code.at(i + 1);
+            if (isConditionalJump(jcond.GetOperation()) && jcond.GetX() == i + 2
+                && jmp.GetOperation() == Operation::JMP && !isTarget.at(i + 1)) {
+                jcond = Instruction(invertJump(jcond.GetOperation()), jmp.GetX(), 0);
+                jmp.SetX(i + 2);
+                isTarget.at(i + 2) = true;
+                changed = true;
+            }
+        }
+
+        std::vector<bool> removed(n, false);
+        for (int32_t i = 0; i < n; i++) {
+            auto& it = code.at(i);
+            if (!isJump(it.GetOperation()) || it.GetX() != i + 1)
+                continue;
+            if (it.GetOperation() == Operation::JMP)
+                removed.at(i) = true;
+            else
+                it = Instruction(isCompareJump(it.GetOperation()) ? Operation::POP2 : Operation::POP, 0, 0);
+            changed = true;
+        }
+
+        //从入口开始标记可达的指令
+        std::vector<bool> reachable(n, false);
+        std::vector<int32_t> worklist;
+        if (n > 0) {
+            reachable.at(0) = true;
+            worklist.emplace_back(0);
+        }
+        while (!worklist.empty()) {
+            int32_t i = worklist.back();
+            worklist.pop_back();
+            auto opr = code.at(i).GetOperation();
+            std::vector<int32_t> next;
+            if (isJump(opr))
+                next.emplace_back(code.at(i).GetX());
+            if (opr != Operation::JMP && !isReturn(opr))
+                next.emplace_back(i + 1);
+            for (auto j : next) {
+                if (j < n && !reachable.at(j)) {
+                    reachable.at(j) = true;
+                    worklist.emplace_back(j);
+                }
+            }
+        }
+        for (int32_t i = 0; i < n; i++) {
+            if (!reachable.at(i) && !removed.at(i)) {
+                removed.at(i) = true;
+                changed = true;
+            }
+        }
+
+        removeInstructions(code, removed);
+        return changed;
+    }
+
+    void Optimizer::removeInstructions(std::vector<Instruction>& code, const std::vector<bool>& removed) {
+        //newIndex[i] 为 i 之前保留下来的指令数，被删除的指令映射到其后第一条保留的指令
+        std::vector<int32_t> newIndex(code.size() + 1, 0);
+        for (size_t i = 0; i < code.size(); i++)
+            newIndex.at(i + 1) = newIndex.at(i) + (removed.at(i) ? 0 : 1);
+
+        std::vector<Instruction> result;
+        for (size_t i = 0; i < code.size(); i++) {
+            if (removed.at(i))
+                continue;
+            auto it = code.at(i);
+            if (isJump(it.GetOperation()))
+                it.SetX(newIndex.at(it.GetX()));
+            result.emplace_back(it);
+        }
+        code.swap(result);
+    }
+
+    void Optimizer::replaceInstructions(std::vector<Instruction>& code, int32_t from, int32_t to,
+                                        const std::vector<Instruction>& replacement) {
+        int32_t delta = (int32_t)replacement.size() - (to - from);
+        auto retarget = [&](Instruction& it) {
+            if (!isJump(it.GetOperation()))
+                return;
+            int32_t target = it.GetX();
+            if (target >= to)
+                it.SetX(target + delta);
+            else if (target > from)
+                it.SetX(from);
+        };
+
+        std::vector<Instruction> result;
+        result.reserve(code.size() + delta);
+        for (int32_t i = 0; i < from; i++) {
+            result.emplace_back(code.at(i));
+            retarget(result.back());
+        }
+        for (auto it : replacement) {
+            if (isJump(it.GetOperation()))
+                it.SetX(it.GetX() + from);
+            result.emplace_back(it);
+        }
+        for (int32_t i = to; i < (int32_t)code.size(); i++) {
+            result.emplace_back(code.at(i));
+            retarget(result.back());
+        }
+        code.swap(result);
+    }
+
+    int32_t Optimizer::finalTarget(const std::vector<Instruction>& code, int32_t target) {
+        //限制步数，避免 while(1); 这样的死循环
+        for (size_t step = 0; step < code.size(); step++) {
+            if (target >= (int32_t)code.size() || code.at(target).GetOperation() != Operation::JMP)
+                break;
+            if (code.at(target).GetX() == target)
+                break;
+            target = code.at(target).GetX();
+        }
+        return target;
+    }
+
+    int32_t Optimizer::stackEffect(const Instruction& instruction) {
+        switch (instruction.GetOperation()) {
+            case Operation::BIPUSH:
+            case Operation::IPUSH:
+            case Operation::DUP:
+            case Operation::LOADC:
+            case Operation::LOADA:
+            case Operation::ISCAN:
+            case Operation::ILOADL:
+            case Operation::ILOADG:
+                return 1;
+            case Operation::DUP2:
+                return 2;
+            case Operation::SNEW:
+                return instruction.GetX();
+            case Operation::POPN:
+                return -instruction.GetX();
+            case Operation::POP2:
+            case Operation::ISTORE:
+            case Operation::IJE:
+            case Operation::IJNE:
+            case Operation::IJL:
+            case Operation::IJGE:
+            case Operation::IJG:
+            case Operation::IJLE:
+                return -2;
+            case Operation::POP:
+            case Operation::IADD:
+            case Operation::ISUB:
+            case Operation::IMUL:
+            case Operation::IDIV:
+            case Operation::ICMP:
+            case Operation::JE:
+            case Operation::JNE:
+            case Operation::JL:
+            case Operation::JGE:
+            case Operation::JG:
+            case Operation::JLE:
+            case Operation::IPRINT:
+            case Operation::CPRINT:
+            case Operation::SPRINT:
+            case Operation::ISTOREL:
+            case Operation::ISTOREG:
+                return -1;
+            case Operation::CALL: {
+                auto& function = _functions._table.at(instruction.GetX());
+                return -function.GetParams() + (function.GetType() == "INT" ? 1 : 0);
+            }
+            default:
+                return 0;
+        }
+    }
+
+    bool Optimizer::stackDepths(const std::vector<Instruction>& code, int32_t params, std::vector<int32_t>& depth) {
+        int32_t where;
+        return stackDepths(code, params, depth, where);
+    }
+
+    bool Optimizer::stackDepths(const std::vector<Instruction>& code, int32_t params, std::vector<int32_t>& depth, int32_t& where) {
+        int32_t n = code.size();
+        where = -1;
+        depth.assign(n, -1);
+        if (n == 0)
+            return true;
+
+        std::vector<int32_t> worklist;
+        depth.at(0) = params;
+        worklist.emplace_back(0);
+        while (!worklist.empty()) {
+            int32_t i = worklist.back();
+            worklist.pop_back();
+            auto opr = code.at(i).GetOperation();
+            if (isReturn(opr))
+                continue;
+            where = i;
+            //编译器不会生成浮点、数组等指令，它们的栈效果不在考虑范围内
+            if (!isIntegerOperation(opr))
+                return false;
+            int32_t after = depth.at(i) + stackEffect(code.at(i));
+            if (after < 0)
+                return false;
+
+            std::vector<int32_t> next;
+            if (isJump(opr))
+                next.emplace_back(code.at(i).GetX());
+            if (opr != Operation::JMP)
+                next.emplace_back(i + 1);
+            for (auto j : next) {
+                //执行到末尾的路径不需要记录
+                if (j >= n)
+                    continue;
+                if (depth.at(j) == -1) {
+                    depth.at(j) = after;
+                    worklist.emplace_back(j);
+                }
+                else if (depth.at(j) != after) {
+                    where = j;
+                    return false;
+                }
+            }
+        }
+        where = -1;
+        return true;
+    }
+
+    bool Optimizer::MaxStackDepth(const std::vector<Instruction>& code, int32_t params, int32_t& max, int32_t& where) {
+        std::vector<int32_t> depth;
+        if (!stackDepths(code, params, depth, where))
+            return false;
+        //执行一条指令的过程中栈最高为执行前后的较大者
+        max = params;
+        for (size_t i = 0; i < code.size(); i++)
+            if (depth.at(i) >= 0 && !isReturn(code.at(i).GetOperation()))
+                max = std::max({max, depth.at(i), depth.at(i) + stackEffect(code.at(i))});
+            else if (depth.at(i) >= 0)
+                max = std::max(max, depth.at(i));
+        return true;
+    }
+
+    //实参k开始前栈高度为base+k，之后直到CALL都不会低于base+k+1
+    bool Optimizer::argumentStarts(const std::vector<Instruction>& code, const std::vector<int32_t>& depth, int32_t call,
+                                   int32_t params, std::vector<int32_t>& argStart) {
+        int32_t base = depth.at(call) - params;
+        argStart.assign(params + 1, call);
+        for (int32_t k = params - 1; k >= 0; k--) {
+            int32_t j = argStart.at(k + 1) - 1;
+            while (j >= 0 && depth.at(j) > base + k)
+                j--;
+            if (j < 0 || depth.at(j) != base + k)
+                return false;
+            argStart.at(k) = j;
+        }
+        //实参中不能有跳转，也不能有跳转到实参中间的指令
+        for (int32_t j = argStart.at(0); j < call; j++)
+            if (isJump(code.at(j).GetOperation()))
+                return false;
+        for (auto& it : code)
+            if (isJump(it.GetOperation()) && it.GetX() > argStart.at(0) && it.GetX() <= call)
+                return false;
+        return true;
+    }
+
+    std::vector<std::vector<int32_t>> Optimizer::callGraph() {
+        std::vector<std::vector<int32_t>> graph(_function_body.size());
+        for (size_t i = 0; i < _function_body.size(); i++) {
+            for (auto& it : _function_body.at(i)._instruction)
+                if (it.GetOperation() == Operation::CALL)
+                    graph.at(i).emplace_back(it.GetX());
+            std::sort(graph.at(i).begin(), graph.at(i).end());
+            graph.at(i).erase(std::unique(graph.at(i).begin(), graph.at(i).end()), graph.at(i).end());
+        }
+        return graph;
+    }
+
+    //非递归的 Tarjan 算法，分量按被调用者在前的顺序产生
+    std::vector<std::vector<int32_t>> Optimizer::callGraphComponents(std::vector<bool>& recursive) {
+        auto graph = callGraph();
+        int32_t n = graph.size();
+        std::vector<int32_t> index(n, -1), low(n, 0);
+        std::vector<bool> onStack(n, false);
+        std::vector<int32_t> stack;
+        std::vector<std::vector<int32_t>> components;
+        recursive.assign(n, false);
+        int32_t counter = 0;
+
+        for (int32_t root = 0; root < n; root++) {
+            if (index.at(root) != -1)
+                continue;
+            //(函数, 下一条要访问的边)
+            std::vector<std::pair<int32_t, size_t>> frames;
+            frames.emplace_back(root, 0);
+            index.at(root) = low.at(root) = counter++;
+            stack.emplace_back(root);
+            onStack.at(root) = true;
+            while (!frames.empty()) {
+                int32_t v = frames.back().first;
+                size_t& edge = frames.back().second;
+                if (edge < graph.at(v).size()) {
+                    int32_t w = graph.at(v).at(edge++);
+                    if (w == v)
+                        recursive.at(v) = true;
+                    if (index.at(w) == -1) {
+                        index.at(w) = low.at(w) = counter++;
+                        stack.emplace_back(w);
+                        onStack.at(w) = true;
+                        frames.emplace_back(w, 0);
+                    }
+                    else if (onStack.at(w))
+                        low.at(v) = std::min(low.at(v), index.at(w));
+                    continue;
+                }
+                frames.pop_back();
+                if (!frames.empty())
+                    low.at(frames.back().first) = std::min(low.at(frames.back().first), low.at(v));
+                if (low.at(v) != index.at(v))
+                    continue;
+                std::vector<int32_t> component;
+                while (true) {
+                    int32_t w = stack.back();
+                    stack.pop_back();
+                    onStack.at(w) = false;
+                    component.emplace_back(w);
+                    if (w == v)
+                        break;
+                }
+                if (component.size() > 1)
+                    for (auto w : component)
+                        recursive.at(w) = true;
+                components.emplace_back(component);
+            }
+        }
+        return components;
+    }
+
+    int32_t Optimizer::matchingStore(const std::vector<Instruction>& code, const std::vector<int32_t>& depth, int32_t i) {
+        int32_t n = code.size();
+        for (int32_t j = i + 1; j < n; j++) {
+            auto opr = code.at(j).GetOperation();
+            if (isJump(opr) || isReturn(opr))
+                return -1;
+            if (opr == Operation::ISTORE && depth.at(j) == depth.at(i) + 2)
+                return j;
+        }
+        return -1;
+    }
+
+    //liveIn[i] = use[i] ∪ (liveOut[i] - def[i])，liveOut[i] 为所有后继的 liveIn 的并
+    void Optimizer::liveness(const std::vector<Instruction>& code, const std::vector<int32_t>& use, const std::vector<int32_t>& def,
+                             int32_t count, std::vector<std::vector<bool>>& liveIn, std::vector<std::vector<bool>>& liveOut) {
+        int32_t n = code.size();
+        liveIn.assign(n + 1, std::vector<bool>(count, false));
+        liveOut.assign(n, std::vector<bool>(count, false));
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int32_t i = n - 1; i >= 0; i--) {
+                auto opr = code.at(i).GetOperation();
+                auto& out = liveOut.at(i);
+                auto merge = [&](int32_t next) {
+                    for (int32_t v = 0; v < count; v++)
+                        if (liveIn.at(next).at(v))
+                            out.at(v) = true;
+                };
+                if (!isReturn(opr) && opr != Operation::JMP)
+                    merge(i + 1);
+                if (isJump(opr))
+                    merge(code.at(i).GetX());
+                auto in = out;
+                if (def.at(i) >= 0)
+                    in.at(def.at(i)) = false;
+                if (use.at(i) >= 0)
+                    in.at(use.at(i)) = true;
+                if (in != liveIn.at(i)) {
+                    liveIn.at(i) = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    int32_t Optimizer::loopDepth(const std::vector<Instruction>& code, int32_t i) {
+        int32_t depth = 0;
+        for (int32_t j = i; j < (int32_t)code.size(); j++) {
+            auto& it = code.at(j);
+            if (isJump(it.GetOperation()) && it.GetX() <= i)
+                depth++;
+        }
+        return depth;
+    }
+
+    std::size_t Optimizer::codeSize(const std::vector<Instruction>& code) {
+        size_t size = 0;
+        for (auto& it : code)
+            size += instructionSize(it);
+        return size;
+    }
+}
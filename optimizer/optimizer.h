@@ -0,0 +1,244 @@
+#pragma once
+
+#include "instruction/instruction.h"
+#include "tokenizer/token.h"
+#include "symbols/symbols.h"
+#include "pass_manager.h"
+
+#include <vector>
+#include <string>
+#include <map>
+#include <istream>
+#include <cstdint>
+#include <cstddef> // for std::size_t
+
+namespace miniplc0 {
+
+    // 一个函数的执行计数：插桩时函数代码的散列值，基本块第一条指令的下标 -> 执行次数
+    struct FunctionProfile {
+        std::int32_t _hash;
+        std::map<std::int32_t, std::int64_t> _counts;
+    };
+    // 函数名 -> 执行计数
+    using Profile = std::map<std::string, FunctionProfile>;
+
+    // 从插桩程序的输出中读取执行计数，没有找到计数时返回 false
+    bool ReadProfile(std::istream&, Profile&);
+
+    // 优化选项
+    struct OptimizationOptions {
+        // 0 为不优化，输出与不带优化时完全相同
+        std::int32_t _level;
+        // 是否向 stderr 输出统计
+        bool _statistics;
+        std::int32_t _inline_budget;
+        std::int32_t _specialize_budget;
+        // 编译时执行的指令数的上限，0 为不在编译时执行
+        std::int64_t _evaluate_budget;
+        // 函数级优化的线程数，0 为硬件线程数
+        std::size_t _jobs;
+        // 是否输出每个函数的栈的最大高度
+        bool _max_stack;
+        // o0 文件的版本，第 2 版使用超级指令，第 3 版再加上全局变量的数据段
+        std::int32_t _version;
+        // 是否生成统计执行计数的插桩代码
+        bool _profile_generate;
+        // 是否使用 _profile 中的执行计数
+        bool _profile_use;
+        Profile _profile;
+        // 增量编译缓存文件，为空时不使用
+        std::string _cache;
+    };
+
+    // 一段指令序列优化前后的统计
+    struct OptimizationStatistics {
+        std::string _name;
+        std::size_t _instructions_before;
+        std::size_t _instructions_after;
+        std::size_t _bytes_before;
+        std::size_t _bytes_after;
+        // 是否作为死函数被删除
+        bool _removed;
+        // 死存储消除删除的指令数
+        std::size_t _dead_store_instructions;
+    };
+
+    class Optimizer final {
+    private:
+        using int32_t = std::int32_t;
+        using int64_t = std::int64_t;
+        using size_t = std::size_t;
+    public:
+        Optimizer(Symbols& constants, Symbols& functions, std::vector<Instruction>& start, std::vector<FunctionBody>& function_body,
+                  int32_t inline_budget = 16, int32_t specialize_budget = 256, int64_t evaluate_budget = 0)
+            : _constants(constants), _functions(functions), _start(start), _function_body(function_body),
+            _inline_budget(inline_budget), _specialize_budget(specialize_budget), _evaluate_budget(evaluate_budget),
+            _statistics({}), _pass_statistics({}),
+            _profile(nullptr), _profile_counts({}), _profile_calls({}), _profile_max_calls(0) {}
+        Optimizer(Optimizer&&) = delete;
+        Optimizer(const Optimizer&) = delete;
+        Optimizer& operator=(Optimizer) = delete;
+
+        // 唯一接口，level 为优化级别，jobs 为函数级优化的线程数（0 为硬件线程数）
+        std::vector<OptimizationStatistics> Optimize(int32_t level = 2, size_t jobs = 0);
+        // 优化从 o0 文件读入的代码，只使用对任何正确的代码都成立的优化
+        void OptimizeBinary(size_t jobs = 0);
+        // 上一次 Optimize 或 OptimizeBinary 中每个优化遍的统计
+        std::vector<PassStatistics> GetPassStatistics() const { return _pass_statistics; }
+
+        // Optimize 使用的执行计数，代码必须是不做循环旋转生成的，nullptr 为不使用
+        void SetProfile(const Profile* profile) { _profile = profile; }
+        // 在每个基本块开头插入计数的代码，main 返回前输出所有的计数
+        void InstrumentProfile();
+        // 代码的散列值，执行计数的散列值不同说明计数已经过期
+        static int32_t CodeHash(const std::vector<Instruction>&);
+
+        // 把常见的指令组合换成 o0 第 2 版的超级指令，应当在所有优化之后执行
+        void SelectSuperinstructions();
+        // 只处理一段代码，params 为参数个数，逐个函数输出时使用
+        void SelectSuperinstructions(std::vector<Instruction>& code, int32_t params) { selectSuperinstructions(code, params); }
+        // 把启动代码开头能在编译时求值的部分换成 o0 第 3 版的数据段，返回数据段的内容
+        // 应当在选择超级指令之前执行
+        std::vector<int32_t> ExtractData();
+
+        // 沿所有路径计算栈的最大高度（包括参数和局部变量）
+        // 汇合点的栈高度不一致或者出现无法分析的指令时返回 false，where 为出错的指令下标
+        bool MaxStackDepth(const std::vector<Instruction>&, int32_t params, int32_t& max, int32_t& where);
+
+    private:
+        // 把连续输出编译时确定的文本的指令合并成一次 SPRINT
+        void fusePrints();
+
+        // 在编译时执行程序，用预先计算的输出和状态代替不依赖输入的部分
+        void evaluateProgram();
+
+        // 删除从 main 和启动代码出发不可达的函数
+        void eliminateDeadFunctions();
+
+        // 只保留 keep 中的函数，重新编号函数表、常量表和 CALL 的操作数
+        // mapping[i] 为被删除的函数 i 调用的替代函数，-1 表示不会被调用
+        void renumberFunctions(const std::vector<bool>& keep, const std::vector<int32_t>& mapping);
+        // 删除不再被函数名或 LOADC 引用的常量并重新编号
+        void removeUnusedConstants();
+
+        // 合并代码相同的函数，调用改为调用保留的函数
+        void foldIdenticalFunctions();
+
+        // 在函数入口用一条 SNEW 分配未初始化的局部变量，生存期不重叠的变量共用槽
+        void allocateSlots(int32_t function);
+
+        // 把启动代码中全局变量的 SNEW 合并为一条
+        void allocateGlobals();
+
+        // 把循环中不变的表达式外提到循环之前
+        void hoistLoopInvariants(int32_t function);
+
+        // 外提循环 [h, e] 中不变的表达式，有改动时返回 true
+        bool hoistLoop(int32_t function, int32_t h, int32_t e);
+
+        // 取出名字和散列值都匹配的函数的执行计数，统计调用点的执行次数
+        void readProfile();
+
+        // 按执行计数旋转热的循环，把冷的基本块移到函数末尾
+        void layoutFunction(int32_t function);
+
+        // 调用点的热度：-1 为冷，1 为热，0 为没有计数
+        int32_t callHotness(int32_t caller, int32_t callee);
+
+        // 常量折叠，有改动时返回 true
+        bool foldConstants(std::vector<Instruction>&);
+
+        // 代数化简和强度削弱，有改动时返回 true
+        bool simplifyAlgebra(std::vector<Instruction>&);
+
+        // 把乘以 2 改为 DUP; IADD，有改动时返回 true
+        bool reduceStrength(std::vector<Instruction>&);
+
+        // 为有常量实参的调用克隆绑定了常量参数的函数
+        void specializeFunctions();
+
+        // 克隆 callee 并把 bound 中的参数绑定为常量，返回克隆的下标，不值得克隆时返回 -1
+        int32_t cloneFunction(int32_t callee, const std::vector<std::pair<int32_t, int32_t>>& bound, int32_t& budget, int32_t& count);
+
+        // 把对自身的尾调用改为跳回函数入口
+        void eliminateTailCalls(int32_t function);
+
+        // 把小的非递归函数内联到调用处
+        void inlineFunctions();
+
+        // 尝试内联 caller 中下标为 call 的 CALL 指令，成功时 next 为内联代码之后的下标
+        bool inlineCallSite(int32_t caller, int32_t call, size_t limit, int32_t& next);
+
+        // 删除写入后不再被读取的局部变量的赋值，返回删除的指令数
+        size_t eliminateDeadStores(int32_t function);
+
+        // 基本块内的公共子表达式消除，重复的值用 DUP 或者读取栈上已有的值代替
+        void eliminateCommonSubexpressions(std::vector<Instruction>&, int32_t params, bool start);
+
+        // 为一段代码选择超级指令
+        void selectSuperinstructions(std::vector<Instruction>&, int32_t params);
+
+        // 窥孔优化，有改动时返回 true
+        bool peephole(std::vector<Instruction>&);
+
+        // 删除被标记的指令，并修正所有跳转目标
+        void removeInstructions(std::vector<Instruction>&, const std::vector<bool>&);
+
+        // 用 replacement 替换 [from, to) 的指令，replacement 中跳转的目标是相对于 from 的下标
+        void replaceInstructions(std::vector<Instruction>&, int32_t from, int32_t to, const std::vector<Instruction>& replacement);
+
+        // 沿着无条件跳转链找到最终的跳转目标
+        int32_t finalTarget(const std::vector<Instruction>&, int32_t);
+
+        // 指令对操作数栈高度的影响，不包括返回指令
+        int32_t stackEffect(const Instruction&);
+
+        // 计算每条指令执行前的栈高度（相对于栈帧起始，包括参数），不可达的指令为 -1
+        // 汇合点的栈高度不一致时返回 false
+        bool stackDepths(const std::vector<Instruction>&, int32_t params, std::vector<int32_t>& depth);
+        bool stackDepths(const std::vector<Instruction>&, int32_t params, std::vector<int32_t>& depth, int32_t& where);
+
+        // 找到下标为 call 的 CALL 的每个实参的起始下标，argStart[params] 为 call
+        bool argumentStarts(const std::vector<Instruction>&, const std::vector<int32_t>& depth, int32_t call,
+                            int32_t params, std::vector<int32_t>& argStart);
+
+        // 下标为 i 的 LOADA 压入的地址被哪条 ISTORE 使用，不在同一个基本块中时返回 -1
+        int32_t matchingStore(const std::vector<Instruction>&, const std::vector<int32_t>& depth, int32_t i);
+
+        // 逆向数据流求活跃变量，use[i]/def[i] 为指令 i 读取/写入的变量，-1 表示没有
+        void liveness(const std::vector<Instruction>&, const std::vector<int32_t>& use, const std::vector<int32_t>& def,
+                      int32_t count, std::vector<std::vector<bool>>& liveIn, std::vector<std::vector<bool>>& liveOut);
+
+        // 调用图，graph[i] 为函数 i 调用的函数
+        std::vector<std::vector<int32_t>> callGraph();
+
+        // 调用图的强连通分量，按被调用者在前的顺序给出，同时标记递归函数
+        std::vector<std::vector<int32_t>> callGraphComponents(std::vector<bool>& recursive);
+
+        // 下标 i 所在的循环层数，由向后的跳转确定
+        int32_t loopDepth(const std::vector<Instruction>&, int32_t i);
+
+        // 指令序列编码后的字节数
+        size_t codeSize(const std::vector<Instruction>&);
+
+    private:
+        Symbols& _constants;
+        Symbols& _functions;
+        std::vector<Instruction>& _start;
+        std::vector<FunctionBody>& _function_body;
+        // 内联的预算，循环每深一层预算翻倍
+        int32_t _inline_budget;
+        // 函数特化时克隆的指令总数的上限
+        int32_t _specialize_budget;
+        // 编译时执行的指令数的上限
+        int64_t _evaluate_budget;
+        std::vector<OptimizationStatistics> _statistics;
+        std::vector<PassStatistics> _pass_statistics;
+        const Profile* _profile;
+        // 每个函数每条指令的执行次数，没有匹配的计数时为空
+        std::vector<std::vector<std::int64_t>> _profile_counts;
+        // (调用者, 被调用者) -> 调用次数
+        std::map<std::pair<std::string, std::string>, std::int64_t> _profile_calls;
+        std::int64_t _profile_max_calls;
+    };
+}
@@ -0,0 +1,95 @@
+#include "pass_manager.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace miniplc0 {
+
+    WorkerPool::WorkerPool(size_t workers)
+        : _threads(), _task(nullptr), _count(0), _next(0), _finished(0), _stop(false) {
+        if (workers == 0)
+            workers = std::max(1u, std::thread::hardware_concurrency());
+        //调用 run 的线程也是一个工作线程
+        for (size_t i = 1; i < workers; i++)
+            _threads.emplace_back([this]() { work(); });
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto& it : _threads)
+            it.join();
+    }
+
+    void WorkerPool::run(size_t count, const std::function<void(size_t)>& task) {
+        if (count == 0)
+            return;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _task = &task;
+        _count = count;
+        _next = 0;
+        _finished = 0;
+        _wake.notify_all();
+        drain(lock);
+        _done.wait(lock, [this]() { return _finished == _count; });
+        _task = nullptr;
+    }
+
+    void WorkerPool::work() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wake.wait(lock, [this]() { return _stop || (_task != nullptr && _next < _count); });
+            if (_stop)
+                return;
+            drain(lock);
+        }
+    }
+
+    void WorkerPool::drain(std::unique_lock<std::mutex>& lock) {
+        while (_task != nullptr && _next < _count) {
+            size_t index = _next++;
+            auto task = _task;
+            lock.unlock();
+            (*task)(index);
+            lock.lock();
+            if (++_finished == _count)
+                _done.notify_all();
+        }
+    }
+
+    void PassManager::addFunctionPass(const std::string& name, std::function<void(int32_t)> pass) {
+        _passes.push_back({name, std::move(pass), nullptr});
+    }
+
+    void PassManager::addModulePass(const std::string& name, std::function<void()> pass) {
+        _passes.push_back({name, nullptr, std::move(pass)});
+    }
+
+    std::vector<PassStatistics> PassManager::run() {
+        _statistics.clear();
+        for (auto& pass : _passes) {
+            size_t before = instructionCount();
+            auto begin = std::chrono::steady_clock::now();
+            if (pass._function) {
+                std::function<void(size_t)> task = [&pass](size_t index) { pass._function((int32_t)index); };
+                _pool.run(_function_body.size(), task);
+            }
+            else
+                pass._module();
+            auto end = std::chrono::steady_clock::now();
+            double milliseconds = std::chrono::duration<double, std::milli>(end - begin).count();
+            _statistics.push_back({pass._name, milliseconds, before, instructionCount()});
+        }
+        return _statistics;
+    }
+
+    std::size_t PassManager::instructionCount() const {
+        size_t count = _start.size();
+        for (auto& it : _function_body)
+            count += it._instruction.size();
+        return count;
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "instruction/instruction.h"
+#include "tokenizer/token.h"
+#include "symbols/symbols.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef> // for std::size_t
+
+namespace miniplc0 {
+
+    // 一个优化遍的耗时和指令数的变化
+    struct PassStatistics {
+        std::string _name;
+        double _milliseconds;
+        std::size_t _instructions_before;
+        std::size_t _instructions_after;
+    };
+
+    // 固定数量的工作线程，调用 run 的线程也参与工作
+    class WorkerPool final {
+    private:
+        using size_t = std::size_t;
+    public:
+        // workers 为 0 时使用硬件线程数
+        explicit WorkerPool(size_t workers);
+        ~WorkerPool();
+        WorkerPool(WorkerPool&&) = delete;
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(WorkerPool) = delete;
+
+        // 并行执行 task(0) ... task(count-1)，全部完成后返回
+        void run(size_t count, const std::function<void(size_t)>& task);
+
+    private:
+        void work();
+        // 领取并执行任务直到没有剩余
+        void drain(std::unique_lock<std::mutex>&);
+
+    private:
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        const std::function<void(size_t)>* _task;
+        size_t _count;
+        size_t _next;
+        size_t _finished;
+        bool _stop;
+    };
+
+    // 按顺序执行的优化遍：
+    //   函数级的遍只修改一个函数体，在工作线程中对所有函数并行执行
+    //   模块级的遍可以修改整个程序（删除函数、内联、启动代码）
+    class PassManager final {
+    private:
+        using int32_t = std::int32_t;
+        using size_t = std::size_t;
+        struct Pass {
+            std::string _name;
+            std::function<void(int32_t)> _function;
+            std::function<void()> _module;
+        };
+    public:
+        PassManager(std::vector<Instruction>& start, std::vector<FunctionBody>& function_body, size_t workers)
+            : _start(start), _function_body(function_body), _pool(workers), _passes({}), _statistics({}) {}
+        PassManager(PassManager&&) = delete;
+        PassManager(const PassManager&) = delete;
+        PassManager& operator=(PassManager) = delete;
+
+        // 对每个函数执行 pass(函数下标)
+        void addFunctionPass(const std::string& name, std::function<void(int32_t)> pass);
+        // 执行一次 pass()
+        void addModulePass(const std::string& name, std::function<void()> pass);
+
+        // 依次执行所有的遍，返回每个遍的统计
+        std::vector<PassStatistics> run();
+
+    private:
+        size_t instructionCount() const;
+
+    private:
+        std::vector<Instruction>& _start;
+        std::vector<FunctionBody>& _function_body;
+        WorkerPool _pool;
+        std::vector<Pass> _passes;
+        std::vector<PassStatistics> _statistics;
+    };
+}
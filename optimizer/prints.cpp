@@ -0,0 +1,83 @@
+#include "optimizer.h"
+
+#include <map>
+#include <tuple>
+
+namespace miniplc0 {
+
+    //常量的长度是 u2
+    static const size_t TextLimit = 0xffff;
+
+    //连续输出编译时确定的文本的指令合并成一次 SPRINT：
+    //  LOADC a; SPRINT | BIPUSH c; CPRINT | PRINTL  ...  ->  LOADC 合并的文本; SPRINT
+    //只合并能减少指令数的序列，除第一条外都不能是跳转目标。合并后不再使用的常量被删除
+    void Optimizer::fusePrints() {
+        std::map<std::string, int32_t> names;
+        for (size_t i = 0; i < _constants._table.size(); i++)
+            names.emplace(_constants._table.at(i).GetName(), i);
+        auto constant = [&](const std::string& text) {
+            if (!names.count(text)) {
+                names[text] = _constants._table.size();
+                _constants.addConstantItem(text, "S", _constants._table.size(), text);
+            }
+            return names.at(text);
+        };
+
+        bool changed = false;
+        for (auto& body : _function_body) {
+            auto& code = body._instruction;
+            int32_t n = code.size();
+            std::vector<bool> isTarget(n + 1, false);
+            for (auto& it : code)
+                if (isJump(it.GetOperation()))
+                    isTarget.at(it.GetX()) = true;
+            //i 开始的一段输出的指令数和文本，不是时返回 0
+            auto piece = [&](int32_t i, std::string& text) {
+                auto opr = code.at(i).GetOperation();
+                if (opr == Operation::PRINTL) {
+                    text = "\n";
+                    return 1;
+                }
+                if (i + 1 >= n || isTarget.at(i + 1))
+                    return 0;
+                auto next = code.at(i + 1).GetOperation();
+                if (opr == Operation::BIPUSH && next == Operation::CPRINT) {
+                    text = std::string(1, (char)code.at(i).GetX());
+                    return 2;
+                }
+                if (opr == Operation::LOADC && next == Operation::SPRINT) {
+                    text = _constants._table.at(code.at(i).GetX()).GetName();
+                    return 2;
+                }
+                return 0;
+            };
+
+            //不重叠的 [from, to) 和合并的文本的常量，从后往前替换，替换不影响前面的下标
+            std::vector<std::tuple<int32_t, int32_t, int32_t>> runs;
+            for (int32_t i = 0; i < n;) {
+                std::string text;
+                int32_t length = piece(i, text);
+                if (length == 0) {
+                    i++;
+                    continue;
+                }
+                int32_t end = i + length;
+                std::string next;
+                for (int32_t k; end < n && !isTarget.at(end) && (k = piece(end, next)) > 0
+                    && text.size() + next.size() <= TextLimit; end += k)
+                    text += next;
+                if (end - i > 2)
+                    runs.emplace_back(i, end, constant(text));
+                i = end;
+            }
+            for (auto it = runs.rbegin(); it != runs.rend(); it++) {
+                auto& [from, to, index] = *it;
+                replaceInstructions(code, from, to, {Instruction(Operation::LOADC, index, 0),
+                                                     Instruction(Operation::SPRINT, 0, 0)});
+                changed = true;
+            }
+        }
+        if (changed)
+            removeUnusedConstants();
+    }
+}
@@ -0,0 +1,291 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace miniplc0 {
+
+    //插桩程序的输出中，计数在这一行之后，每个函数一行：
+    //  函数名 散列值 {基本块的下标 执行次数}
+    static const std::string ProfileMarker = "cc0-profile";
+
+    bool ReadProfile(std::istream& input, Profile& profile) {
+        std::vector<std::string> lines;
+        bool found = false;
+        std::string line;
+        //程序的输出可能没有以换行结束，取最后一个以标记结尾的行
+        while (std::getline(input, line)) {
+            if (line.size() >= ProfileMarker.size()
+                && line.compare(line.size() - ProfileMarker.size(), ProfileMarker.size(), ProfileMarker) == 0) {
+                found = true;
+                lines.clear();
+                continue;
+            }
+            if (found)
+                lines.push_back(line);
+        }
+        if (!found)
+            return false;
+
+        profile.clear();
+        for (auto& it : lines) {
+            std::istringstream ss(it);
+            std::string name;
+            int64_t hash;
+            if (!(ss >> name >> hash))
+                continue;
+            FunctionProfile function;
+            function._hash = (int32_t)hash;
+            int64_t index, count;
+            while (ss >> index >> count)
+                //计数器是 32 位的，溢出后按无符号数解释
+                function._counts[(int32_t)index] = count < 0 ? count + ((int64_t)1 << 32) : count;
+            profile[name] = function;
+        }
+        return true;
+    }
+
+    //FNV-1a
+    int32_t Optimizer::CodeHash(const std::vector<Instruction>& code) {
+        uint32_t hash = 2166136261u;
+        auto mix = [&hash](uint32_t value) {
+            for (int k = 0; k < 4; k++) {
+                hash ^= (value >> (8 * k)) & 0xff;
+                hash *= 16777619u;
+            }
+        };
+        for (auto& it : code) {
+            mix((uint32_t)it.GetOperation());
+            mix((uint32_t)it.GetX());
+            mix((uint32_t)it.GetY());
+        }
+        return (int32_t)hash;
+    }
+
+    //基本块的第一条指令：入口、跳转目标、跳转和返回之后的指令
+    static std::vector<bool> blockLeaders(const std::vector<Instruction>& code) {
+        int32_t n = code.size();
+        std::vector<bool> leader(n + 1, false);
+        leader.at(0) = true;
+        for (int32_t i = 0; i < n; i++) {
+            auto opr = code.at(i).GetOperation();
+            if (isJump(opr))
+                leader.at(code.at(i).GetX()) = true;
+            if (isJump(opr) || isReturn(opr))
+                leader.at(i + 1) = true;
+        }
+        return leader;
+    }
+
+    //计数器是启动代码之后的全局变量，在启动代码末尾初始化为 0。
+    //每个基本块开头插入 LOADA 1,c; LOADA 1,c; ILOAD; BIPUSH 1; IADD; ISTORE，
+    //main 的每条返回指令之前调用输出计数的函数 $profile。
+    //计数记录的是插桩之前的下标，散列值也是对插桩之前的代码计算的。
+    void Optimizer::InstrumentProfile() {
+        int32_t globals = 0;
+        std::vector<int32_t> depth;
+        if (!_start.empty() && stackDepths(_start, 0, depth) && depth.back() >= 0)
+            globals = depth.back() + stackEffect(_start.back());
+
+        int32_t functions = _function_body.size();
+        int32_t dump = functions;
+        int32_t counters = 0;
+        std::vector<std::vector<std::pair<int32_t, int32_t>>> slots(functions);
+        std::vector<int32_t> hash(functions);
+        for (int32_t f = 0; f < functions; f++) {
+            auto& code = _function_body.at(f)._instruction;
+            hash.at(f) = CodeHash(code);
+            auto leader = blockLeaders(code);
+            bool main = _functions._table.at(f).GetName() == "main";
+
+            std::vector<Instruction> result;
+            std::vector<int32_t> position(code.size() + 1, 0);
+            for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+                position.at(i) = result.size();
+                if (leader.at(i)) {
+                    int32_t slot = globals + counters++;
+                    slots.at(f).emplace_back(i, slot);
+                    result.emplace_back(Operation::LOADA, 1, slot);
+                    result.emplace_back(Operation::LOADA, 1, slot);
+                    result.emplace_back(Operation::ILOAD, 0, 0);
+                    result.emplace_back(Operation::BIPUSH, 1, 0);
+                    result.emplace_back(Operation::IADD, 0, 0);
+                    result.emplace_back(Operation::ISTORE, 0, 0);
+                }
+                if (main && isReturn(code.at(i).GetOperation()))
+                    result.emplace_back(Operation::CALL, dump, 0);
+                result.emplace_back(code.at(i));
+            }
+            position.at(code.size()) = result.size();
+            for (auto& it : result)
+                if (isJump(it.GetOperation()))
+                    it.SetX(position.at(it.GetX()));
+            code.swap(result);
+        }
+
+        for (int32_t c = 0; c < counters; c++)
+            _start.emplace_back(Operation::BIPUSH, 0, 0);
+
+        auto text = [&](std::vector<Instruction>& code, int32_t constant) {
+            code.emplace_back(Operation::LOADC, constant, 0);
+            code.emplace_back(Operation::SPRINT, 0, 0);
+        };
+        auto number = [&](std::vector<Instruction>& code, int32_t value) {
+            code.emplace_back(value >= 0 && value <= 127 ? Operation::BIPUSH : Operation::IPUSH, value, 0);
+            code.emplace_back(Operation::IPRINT, 0, 0);
+        };
+        auto space = [&](std::vector<Instruction>& code) {
+            code.emplace_back(Operation::BIPUSH, ' ', 0);
+            code.emplace_back(Operation::CPRINT, 0, 0);
+        };
+
+        int32_t marker = _constants._table.size();
+        _constants.addConstantItem(ProfileMarker, "S", marker, ProfileMarker);
+        std::vector<Instruction> code;
+        code.emplace_back(Operation::PRINTL, 0, 0);
+        text(code, marker);
+        code.emplace_back(Operation::PRINTL, 0, 0);
+        for (int32_t f = 0; f < functions; f++) {
+            text(code, _functions._table.at(f).GetIndex());
+            space(code);
+            number(code, hash.at(f));
+            for (auto& it : slots.at(f)) {
+                space(code);
+                number(code, it.first);
+                space(code);
+                code.emplace_back(Operation::LOADA, 1, it.second);
+                code.emplace_back(Operation::ILOAD, 0, 0);
+                code.emplace_back(Operation::IPRINT, 0, 0);
+            }
+            code.emplace_back(Operation::PRINTL, 0, 0);
+        }
+        code.emplace_back(Operation::RET, 0, 0);
+
+        int32_t name = _constants._table.size();
+        _constants.addConstantItem("$profile", "VOID", name, "$profile");
+        _functions._table.emplace_back("$profile", "VOID", name, 0);
+        _function_body.emplace_back(FunctionBody());
+        _function_body.back()._instruction = std::move(code);
+    }
+
+    void Optimizer::readProfile() {
+        _profile_counts.assign(_function_body.size(), {});
+        _profile_calls.clear();
+        _profile_max_calls = 0;
+        for (size_t f = 0; f < _function_body.size(); f++) {
+            auto& code = _function_body.at(f)._instruction;
+            auto name = _functions._table.at(f).GetName();
+            auto found = _profile->find(name);
+            //没有计数或者代码已经改变的函数仍然使用静态的估计
+            if (found == _profile->end() || found->second._hash != CodeHash(code))
+                continue;
+            auto& counts = found->second._counts;
+            auto leader = blockLeaders(code);
+            auto& result = _profile_counts.at(f);
+            result.assign(code.size(), 0);
+            int64_t current = 0;
+            for (size_t i = 0; i < code.size(); i++) {
+                if (leader.at(i)) {
+                    auto it = counts.find(i);
+                    current = it == counts.end() ? 0 : it->second;
+                }
+                result.at(i) = current;
+                if (code.at(i).GetOperation() == Operation::CALL) {
+                    auto callee = _functions._table.at(code.at(i).GetX()).GetName();
+                    auto& calls = _profile_calls[{name, callee}];
+                    calls += current;
+                    _profile_max_calls = std::max(_profile_max_calls, calls);
+                }
+            }
+        }
+    }
+
+    //代码由不旋转循环的分析器生成，循环的形式为
+    //  h: 条件; Jcc e+1; 循环体; e: JMP h
+    //循环体执行过的循环旋转为 h: 条件; Jcc e+1; b: 循环体; 条件; J!cc b，每次迭代少执行一次跳转。
+    //从没执行过的循环不旋转，避免复制条件的代码。
+    //函数执行过时，从没执行过的基本块按原来的顺序移到函数末尾，执行过的代码连续排列。
+    void Optimizer::layoutFunction(int32_t function) {
+        auto& counts = _profile_counts.at(function);
+        if (counts.empty())
+            return;
+        auto& code = _function_body.at(function)._instruction;
+
+        for (int32_t e = (int32_t)code.size() - 1; e >= 0; e--) {
+            if (code.at(e).GetOperation() != Operation::JMP || code.at(e).GetX() > e)
+                continue;
+            int32_t h = code.at(e).GetX();
+            int32_t j = h;
+            while (j < e && !isJump(code.at(j).GetOperation()) && !isReturn(code.at(j).GetOperation()))
+                j++;
+            if (j == e || !isConditionalJump(code.at(j).GetOperation()) || code.at(j).GetX() != e + 1 || counts.at(j + 1) == 0)
+                continue;
+            //条件中间不能有其他跳转进入
+            bool entered = false;
+            for (auto& it : code)
+                if (isJump(it.GetOperation()) && it.GetX() > h && it.GetX() <= j)
+                    entered = true;
+            if (entered)
+                continue;
+
+            std::vector<Instruction> replacement(code.begin() + h, code.begin() + j);
+            replacement.emplace_back(invertJump(code.at(j).GetOperation()), j + 1 - e, 0);
+            replaceInstructions(code, e, e + 1, replacement);
+            int64_t body = counts.at(j + 1);
+            counts.erase(counts.begin() + e);
+            counts.insert(counts.begin() + e, replacement.size(), body);
+        }
+
+        int32_t n = code.size();
+        if (n == 0 || counts.at(0) == 0)
+            return;
+        auto leader = blockLeaders(code);
+        std::vector<int32_t> blocks;
+        for (int32_t i = 0; i < n; i++)
+            if (leader.at(i))
+                blocks.push_back(i);
+        std::vector<int32_t> order;
+        for (auto b : blocks)
+            if (b == 0 || counts.at(b) > 0)
+                order.push_back(b);
+        if (order.size() == blocks.size())
+            return;
+        for (auto b : blocks)
+            if (b != 0 && counts.at(b) == 0)
+                order.push_back(b);
+
+        //块 b 原来落入下一个块时，如果下一个块不再紧跟在后面，补一条 JMP
+        std::vector<Instruction> result;
+        std::vector<int32_t> position(n + 1, -1);
+        for (size_t k = 0; k < order.size(); k++) {
+            int32_t b = order.at(k);
+            int32_t end = b + 1;
+            while (end < n && !leader.at(end))
+                end++;
+            position.at(b) = result.size();
+            result.insert(result.end(), code.begin() + b, code.begin() + end);
+            auto opr = code.at(end - 1).GetOperation();
+            bool falls = opr != Operation::JMP && !isReturn(opr);
+            if (falls && (k + 1 == order.size() || order.at(k + 1) != end))
+                result.emplace_back(Operation::JMP, end, 0);
+        }
+        //跳转到函数末尾（n）的只可能是补上的 JMP，保持不变
+        position.at(n) = result.size();
+        for (auto& it : result)
+            if (isJump(it.GetOperation()))
+                it.SetX(position.at(it.GetX()));
+        code.swap(result);
+    }
+
+    int32_t Optimizer::callHotness(int32_t caller, int32_t callee) {
+        if (_profile == nullptr)
+            return 0;
+        auto found = _profile_calls.find({_functions._table.at(caller).GetName(), _functions._table.at(callee).GetName()});
+        if (found == _profile_calls.end())
+            return 0;
+        if (found->second == 0)
+            return -1;
+        //至少是最热的调用点的 1/16
+        return found->second * 16 >= _profile_max_calls ? 1 : 0;
+    }
+}
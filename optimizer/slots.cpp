@@ -0,0 +1,166 @@
+#include "optimizer.h"
+
+#include <algorithm>
+
+namespace miniplc0 {
+
+    //未初始化的局部变量由声明处的 SNEW 1 分配，初始化的局部变量占用初始化表达式的结果。
+    //重新排列栈帧：
+    //  | 参数 | 未初始化的变量（共用的槽） | 初始化的变量（保持原来的顺序） |
+    //在入口处用一条 SNEW n 分配所有未初始化的变量，生存期不重叠的变量共用一个槽。
+    //在入口处就活跃（可能在赋值之前被读取）或者用法无法识别的变量不和其他变量共用。
+    void Optimizer::allocateSlots(int32_t function) {
+        auto& code = _function_body.at(function)._instruction;
+        int32_t params = _functions._table.at(function).GetParams();
+        int32_t n = code.size();
+        std::vector<int32_t> depth;
+        if (!stackDepths(code, params, depth))
+            return;
+
+        //SNEW 1 在栈高度为 d 处分配的就是槽 d
+        int32_t maxSlot = params;
+        for (auto& it : code)
+            if (it.GetOperation() == Operation::LOADA && it.GetX() == 0)
+                maxSlot = std::max(maxSlot, it.GetY() + 1);
+        std::vector<int32_t> variable;
+        std::vector<int32_t> slotVariable;
+        std::vector<bool> removed(n, false);
+        for (int32_t i = 0; i < n; i++) {
+            if (code.at(i).GetOperation() != Operation::SNEW)
+                continue;
+            if (code.at(i).GetX() != 1 || depth.at(i) < params)
+                return;
+            maxSlot = std::max(maxSlot, depth.at(i) + 1);
+            variable.emplace_back(depth.at(i));
+            removed.at(i) = true;
+        }
+        if (variable.empty())
+            return;
+        slotVariable.assign(maxSlot, -1);
+        for (size_t v = 0; v < variable.size(); v++)
+            slotVariable.at(variable.at(v)) = v;
+        int32_t count = variable.size();
+
+        //读取为 LOADA 0,k; ILOAD，写入为 LOADA 0,k; ...; ISTORE，写入发生在 ISTORE 处
+        std::vector<int32_t> use(n, -1), def(n, -1);
+        std::vector<bool> pinned(count, false);
+        for (int32_t i = 0; i < n; i++) {
+            auto& it = code.at(i);
+            if (it.GetOperation() != Operation::LOADA || it.GetX() != 0 || slotVariable.at(it.GetY()) < 0)
+                continue;
+            int32_t v = slotVariable.at(it.GetY());
+            if (depth.at(i) < 0)
+                continue;
+            if (i + 1 < n && code.at(i + 1).GetOperation() == Operation::ILOAD) {
+                use.at(i) = v;
+                continue;
+            }
+            int32_t j = matchingStore(code, depth, i);
+            if (j >= 0 && def.at(j) < 0)
+                def.at(j) = v;
+            else
+                pinned.at(v) = true;
+        }
+
+        std::vector<std::vector<bool>> liveIn, liveOut;
+        liveness(code, use, def, count, liveIn, liveOut);
+        for (int32_t v = 0; v < count; v++)
+            if (liveIn.at(0).at(v))
+                pinned.at(v) = true;
+
+        //写入 v 时活跃的其他变量和 v 冲突
+        std::vector<std::vector<bool>> interfere(count, std::vector<bool>(count, false));
+        for (int32_t i = 0; i < n; i++) {
+            int32_t v = def.at(i);
+            if (v < 0)
+                continue;
+            for (int32_t u = 0; u < count; u++)
+                if (u != v && liveOut.at(i).at(u))
+                    interfere.at(u).at(v) = interfere.at(v).at(u) = true;
+        }
+
+        //按声明顺序贪心着色
+        std::vector<int32_t> color(count, -1);
+        int32_t colors = 0;
+        for (int32_t v = 0; v < count; v++) {
+            std::vector<bool> taken(colors, false);
+            for (int32_t u = 0; u < v; u++)
+                if (pinned.at(u) || pinned.at(v) || interfere.at(u).at(v))
+                    taken.at(color.at(u)) = true;
+            color.at(v) = std::find(taken.begin(), taken.end(), false) - taken.begin();
+            colors = std::max(colors, color.at(v) + 1);
+        }
+
+        //其余的槽 s 前面少了 s 之下未初始化变量的个数，再加上 colors 个共用的槽
+        std::vector<int32_t> below(maxSlot + 1, 0);
+        for (int32_t s = 0; s < maxSlot; s++)
+            below.at(s + 1) = below.at(s) + (slotVariable.at(s) >= 0 ? 1 : 0);
+        auto newSlot = [&](int32_t s) {
+            if (s < params)
+                return s;
+            if (slotVariable.at(s) >= 0)
+                return params + color.at(slotVariable.at(s));
+            return s - below.at(s) + colors;
+        };
+        for (auto& it : code)
+            if (it.GetOperation() == Operation::LOADA && it.GetX() == 0)
+                it.SetY(newSlot(it.GetY()));
+
+        removeInstructions(code, removed);
+        replaceInstructions(code, 0, 0, {Instruction(Operation::SNEW, colors, 0)});
+    }
+
+    //全局变量不做共用，只把启动代码中的 SNEW 1 合并为开头的一条 SNEW n，
+    //并修正启动代码中的 LOADA 0 和函数中的 LOADA 1
+    void Optimizer::allocateGlobals() {
+        std::vector<int32_t> depth;
+        if (!stackDepths(_start, 0, depth))
+            return;
+        int32_t n = _start.size();
+        int32_t maxSlot = 0;
+        std::vector<bool> removed(n, false);
+        std::vector<bool> uninitialized;
+        auto grow = [&](int32_t size) {
+            maxSlot = std::max(maxSlot, size);
+            if ((int32_t)uninitialized.size() < maxSlot)
+                uninitialized.resize(maxSlot, false);
+        };
+        for (int32_t i = 0; i < n; i++) {
+            auto& it = _start.at(i);
+            if (it.GetOperation() == Operation::LOADA && it.GetX() == 0)
+                grow(it.GetY() + 1);
+            if (it.GetOperation() != Operation::SNEW)
+                continue;
+            if (it.GetX() != 1 || depth.at(i) < 0)
+                return;
+            grow(depth.at(i) + 1);
+            uninitialized.at(depth.at(i)) = true;
+            removed.at(i) = true;
+        }
+        for (auto& body : _function_body)
+            for (auto& it : body._instruction)
+                if (it.GetOperation() == Operation::LOADA && it.GetX() == 1)
+                    grow(it.GetY() + 1);
+
+        int32_t count = std::count(uninitialized.begin(), uninitialized.end(), true);
+        if (count == 0)
+            return;
+        std::vector<int32_t> newSlot(maxSlot, 0);
+        int32_t before = 0;
+        for (int32_t s = 0; s < maxSlot; s++) {
+            newSlot.at(s) = uninitialized.at(s) ? before : s - before + count;
+            if (uninitialized.at(s))
+                before++;
+        }
+        for (auto& it : _start)
+            if (it.GetOperation() == Operation::LOADA && it.GetX() == 0)
+                it.SetY(newSlot.at(it.GetY()));
+        for (auto& body : _function_body)
+            for (auto& it : body._instruction)
+                if (it.GetOperation() == Operation::LOADA && it.GetX() == 1)
+                    it.SetY(newSlot.at(it.GetY()));
+
+        removeInstructions(_start, removed);
+        replaceInstructions(_start, 0, 0, {Instruction(Operation::SNEW, count, 0)});
+    }
+}
@@ -0,0 +1,145 @@
+#include "optimizer.h"
+
+#include <map>
+
+namespace miniplc0 {
+
+    //找到实参是常量（单条 BIPUSH/IPUSH）的调用，被调用者中没有被写过的参数可以绑定为常量。
+    //为每种 (函数, 绑定的参数和值) 克隆一个去掉这些参数的函数，读取参数处换成常量，
+    //折叠之后如果代码有变化就使用克隆，调用处删除这些实参并改为调用克隆。
+    //克隆中新出现的常量实参继续处理，克隆的指令总数不超过 _specialize_budget。
+    void Optimizer::specializeFunctions() {
+        int32_t budget = _specialize_budget;
+        //(函数, 绑定) -> 克隆的下标，-1 表示折叠后没有变化，不值得克隆
+        std::map<std::pair<int32_t, std::vector<std::pair<int32_t, int32_t>>>, int32_t> clones;
+        std::map<int32_t, int32_t> cloneCount;
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int32_t caller = -1; caller < (int32_t)_function_body.size() && !changed; caller++) {
+                auto& code = caller < 0 ? _start : _function_body.at(caller)._instruction;
+                std::vector<int32_t> depth;
+                if (!stackDepths(code, caller < 0 ? 0 : _functions._table.at(caller).GetParams(), depth))
+                    continue;
+                for (int32_t call = 0; call < (int32_t)code.size(); call++) {
+                    if (code.at(call).GetOperation() != Operation::CALL || depth.at(call) < 0)
+                        continue;
+                    int32_t callee = code.at(call).GetX();
+                    int32_t params = _functions._table.at(callee).GetParams();
+                    if (params == 0 || _functions._table.at(callee).GetName() == "main")
+                        continue;
+                    std::vector<int32_t> argStart;
+                    if (!argumentStarts(code, depth, call, params, argStart))
+                        continue;
+
+                    //被调用者中被写过的参数不能绑定
+                    auto& body = _function_body.at(callee)._instruction;
+                    std::vector<bool> written(params, false);
+                    for (size_t r = 0; r < body.size(); r++) {
+                        auto& it = body.at(r);
+                        if (it.GetOperation() == Operation::LOADA && it.GetX() == 0 && it.GetY() < params
+                            && (r + 1 >= body.size() || body.at(r + 1).GetOperation() != Operation::ILOAD))
+                            written.at(it.GetY()) = true;
+                    }
+                    std::vector<std::pair<int32_t, int32_t>> bound;
+                    for (int32_t k = 0; k < params; k++) {
+                        auto& arg = code.at(argStart.at(k));
+                        bool constant = argStart.at(k + 1) - argStart.at(k) == 1
+                            && (arg.GetOperation() == Operation::BIPUSH || arg.GetOperation() == Operation::IPUSH);
+                        if (constant && !written.at(k))
+                            bound.emplace_back(k, arg.GetX());
+                    }
+                    if (bound.empty())
+                        continue;
+
+                    auto key = std::make_pair(callee, bound);
+                    auto found = clones.find(key);
+                    int32_t clone;
+                    if (found != clones.end())
+                        clone = found->second;
+                    else {
+                        clone = cloneFunction(callee, bound, budget, cloneCount[callee]);
+                        clones[key] = clone;
+                    }
+                    if (clone < 0)
+                        continue;
+
+                    //克隆时 _function_body 可能重新分配，重新取调用者的代码
+                    auto& target = caller < 0 ? _start : _function_body.at(caller)._instruction;
+                    std::vector<bool> removed(target.size(), false);
+                    for (auto& it : bound)
+                        removed.at(argStart.at(it.first)) = true;
+                    target.at(call).SetX(clone);
+                    removeInstructions(target, removed);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    //克隆 callee，bound 中的参数换成常量，其余的参数依次前移；失败或者不值得时返回 -1
+    int32_t Optimizer::cloneFunction(int32_t callee, const std::vector<std::pair<int32_t, int32_t>>& bound, int32_t& budget,
+                                     int32_t& count) {
+        auto& item = _functions._table.at(callee);
+        auto body = _function_body.at(callee)._instruction;
+        int32_t params = item.GetParams();
+        if ((int32_t)body.size() > budget)
+            return -1;
+
+        std::vector<int32_t> value(params, 0);
+        std::vector<bool> isBound(params, false);
+        for (auto& it : bound) {
+            isBound.at(it.first) = true;
+            value.at(it.first) = it.second;
+        }
+        std::vector<int32_t> newSlot(params, 0);
+        int32_t kept = 0;
+        for (int32_t k = 0; k < params; k++)
+            if (!isBound.at(k))
+                newSlot.at(k) = kept++;
+        int32_t removedParams = params - kept;
+
+        std::vector<Instruction> code;
+        std::vector<int32_t> position(body.size() + 1, 0);
+        for (size_t r = 0; r < body.size(); r++) {
+            position.at(r) = code.size();
+            auto it = body.at(r);
+            if (it.GetOperation() == Operation::LOADA && it.GetX() == 0) {
+                int32_t off = it.GetY();
+                if (off < params && isBound.at(off)) {
+                    //LOADA 0,off; ILOAD 换成常量
+                    code.emplace_back(Operation::IPUSH, value.at(off), 0);
+                    r++;
+                    position.at(r) = code.size();
+                    continue;
+                }
+                it.SetY(off < params ? newSlot.at(off) : off - removedParams);
+            }
+            code.emplace_back(it);
+        }
+        position.at(body.size()) = code.size();
+        for (auto& it : code)
+            if (isJump(it.GetOperation()))
+                it.SetX(position.at(it.GetX()));
+
+        //折叠没有效果时只省下了传参，不值得增加代码
+        bool folded = false;
+        while (foldConstants(code) | simplifyAlgebra(code))
+            folded = true;
+        while (peephole(code));
+        if (!folded)
+            return -1;
+        budget -= code.size();
+
+        int32_t index = _function_body.size();
+        int32_t constant = _constants._table.size();
+        std::string name = item.GetName() + "$" + std::to_string(++count);
+        _constants.addConstantItem(name, item.GetType(), constant, name);
+        _functions._table.emplace_back(name, item.GetType(), constant, kept);
+        _function_body.emplace_back(FunctionBody());
+        _function_body.back()._instruction = std::move(code);
+        return index;
+    }
+}
@@ -0,0 +1,119 @@
+#include "optimizer.h"
+
+namespace miniplc0 {
+
+    void Optimizer::SelectSuperinstructions() {
+        selectSuperinstructions(_start, 0);
+        for (size_t i = 0; i < _function_body.size(); i++)
+            selectSuperinstructions(_function_body.at(i)._instruction, _functions._table.at(i).GetParams());
+    }
+
+    //先把 LOADA x,y; <值>; ISTORE 换成 <值>; ISTOREL/ISTOREG y，地址不再占用栈上的槽，
+    //地址入栈到 ISTORE 之间读取更高的栈上的槽的 LOADA 0,d 改为 d-1。
+    //再把相邻的两条指令合并：
+    //  LOADA x,y; ILOAD  ->  ILOADL/ILOADG y
+    //  PUSH c; IADD      ->  IADDI c
+    //  PUSH c; ISUB      ->  IADDI -c
+    //  ISUB; Jcc L       ->  IJcc L
+    //第二条指令不能是跳转目标，操作数超出编码范围时不合并
+    void Optimizer::selectSuperinstructions(std::vector<Instruction>& code, int32_t params) {
+        std::vector<int32_t> depth;
+        if (!stackDepths(code, params, depth))
+            return;
+        int32_t n = code.size();
+        auto fits = [](int32_t offset) { return offset >= 0 && offset <= 0xffff; };
+        auto isAddress = [&](int32_t i) {
+            auto& it = code.at(i);
+            return it.GetOperation() == Operation::LOADA && (it.GetX() == 0 || it.GetX() == 1) && fits(it.GetY());
+        };
+
+        std::vector<bool> isTarget(n + 1, false);
+        for (auto& it : code)
+            if (isJump(it.GetOperation()))
+                isTarget.at(it.GetX()) = true;
+        std::vector<bool> removed(n, false);
+        std::vector<int32_t> shift(n, 0);
+        std::vector<std::pair<int32_t, int32_t>> stores;
+        for (int32_t i = 0; i < n; i++) {
+            if (!isAddress(i) || depth.at(i) < 0 || (i + 1 < n && code.at(i + 1).GetOperation() == Operation::ILOAD))
+                continue;
+            int32_t j = matchingStore(code, depth, i);
+            if (j < 0)
+                continue;
+            //地址只能被 ISTORE 使用：它在栈顶时只能执行不读取栈的指令，也不能被 LOADA 0,d 读取；
+            //其他路径不能跳进来使用别的地址
+            int32_t slot = depth.at(i);
+            bool used = false;
+            for (int32_t k = i + 1; k <= j && !used; k++)
+                used = isTarget.at(k);
+            for (int32_t k = i + 1; k < j && !used; k++) {
+                auto& it = code.at(k);
+                auto opr = it.GetOperation();
+                if (depth.at(k) <= slot || (opr == Operation::LOADA && it.GetX() == 0 && it.GetY() == slot))
+                    used = true;
+                else if (depth.at(k) == slot + 1) {
+                    bool push = opr == Operation::BIPUSH || opr == Operation::IPUSH || opr == Operation::LOADC
+                        || opr == Operation::LOADA || opr == Operation::ISCAN || opr == Operation::SNEW
+                        || (opr == Operation::CALL && _functions._table.at(it.GetX()).GetParams() == 0);
+                    used = !push;
+                }
+            }
+            if (used)
+                continue;
+            for (int32_t k = i + 1; k < j; k++) {
+                auto& it = code.at(k);
+                if (it.GetOperation() == Operation::LOADA && it.GetX() == 0 && it.GetY() > slot)
+                    shift.at(k)++;
+            }
+            removed.at(i) = true;
+            stores.emplace_back(i, j);
+        }
+        for (int32_t i = 0; i < n; i++)
+            if (shift.at(i) != 0)
+                code.at(i).SetY(code.at(i).GetY() - shift.at(i));
+        for (auto& it : stores) {
+            auto& address = code.at(it.first);
+            code.at(it.second) = Instruction(address.GetX() == 0 ? Operation::ISTOREL : Operation::ISTOREG, address.GetY(), 0);
+        }
+        removeInstructions(code, removed);
+
+        n = code.size();
+        isTarget.assign(n + 1, false);
+        for (auto& it : code)
+            if (isJump(it.GetOperation()))
+                isTarget.at(it.GetX()) = true;
+        removed.assign(n, false);
+        for (int32_t i = 0; i + 1 < n; i++) {
+            if (isTarget.at(i + 1))
+                continue;
+            auto& it = code.at(i);
+            auto opr = it.GetOperation();
+            auto next = code.at(i + 1).GetOperation();
+            if (isAddress(i) && next == Operation::ILOAD)
+                it = Instruction(it.GetX() == 0 ? Operation::ILOADL : Operation::ILOADG, it.GetY(), 0);
+            else if ((opr == Operation::BIPUSH || opr == Operation::IPUSH) && (next == Operation::IADD || next == Operation::ISUB)) {
+                int64_t value = next == Operation::IADD ? (int64_t)it.GetX() : -(int64_t)it.GetX();
+                if (value < -128 || value > 127)
+                    continue;
+                it = Instruction(Operation::IADDI, (int32_t)value, 0);
+            }
+            else if (opr == Operation::ISUB && isConditionalJump(next)) {
+                Operation fused;
+                switch (next) {
+                    case Operation::JE: fused = Operation::IJE; break;
+                    case Operation::JNE: fused = Operation::IJNE; break;
+                    case Operation::JL: fused = Operation::IJL; break;
+                    case Operation::JGE: fused = Operation::IJGE; break;
+                    case Operation::JG: fused = Operation::IJG; break;
+                    default: fused = Operation::IJLE; break;
+                }
+                it = Instruction(fused, code.at(i + 1).GetX(), 0);
+            }
+            else
+                continue;
+            removed.at(i + 1) = true;
+            i++;
+        }
+        removeInstructions(code, removed);
+    }
+}
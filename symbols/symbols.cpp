@@ -47,6 +47,16 @@ namespace miniplc0{
         return Tableitem("", "", -1, -1);
     }
 
+    int32_t Symbols::getPosition(const std::string& s) {
+        long long unsigned int i;
+        for(i=0; i<_table.size(); i++)
+        {
+            if(_table.at(i).GetName() == s)
+                return i;
+        }
+        return -1;
+    }
+
     void FunctionBody::_add(const Token& tk, std::map<std::string, int32_t>& mp) {
         if (tk.GetType() != TokenType::IDENTIFIER)
             DieAndPrint("only identifier can be added to the table.");
@@ -89,6 +89,8 @@ namespace miniplc0{
         void addFunctionItem(string name, string type, int32_t index, int32_t params);
         bool isFunction(const std::string&);
         Tableitem getTableitem(const std::string&);
+        //在表中的下标，不存在时为 -1
+        int32_t getPosition(const std::string&);
         bool functionItemParamsPlus(const std::string&);
     };
 }
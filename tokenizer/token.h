@@ -45,11 +45,13 @@ namespace miniplc0 {
 		NOTEQUAL,
 		COMMA,
 		SEMICOLON,
+		COLON,
 		LEFT_BRACKET,
 		RIGHT_BRACKET,
 		LEFT_BRACE,
 		RIGHT_BRACE,
-		COMMIT
+		COMMIT,
+		STRING_LITERAL
 	};
 
 	class Token final {
@@ -127,6 +127,12 @@ namespace miniplc0 {
                             case ';':
                                 current_state = DFAState::SEMICOLON_STATE;
                                 break;
+                            case ':':
+                                current_state = DFAState::COLON_STATE;
+                                break;
+                            case '"':
+                                current_state = DFAState::STRING_LITERAL_STATE;
+                                break;
                             default:
                                 invalid = true;
                                 break;
@@ -465,6 +471,10 @@ namespace miniplc0 {
                     unreadLast();
                     return std::make_pair(std::make_optional<Token>(TokenType::SEMICOLON, ';', pos, currentPos()), std::optional<CompilationError>());
                 }
+                case COLON_STATE: {
+                    unreadLast();
+                    return std::make_pair(std::make_optional<Token>(TokenType::COLON, ':', pos, currentPos()), std::optional<CompilationError>());
+                }
                 case COMMA_STATE: {
                     unreadLast();
                     return std::make_pair(std::make_optional<Token>(TokenType::COMMA, ',', pos, currentPos()), std::optional<CompilationError>());
@@ -500,6 +510,62 @@ namespace miniplc0 {
                         unreadLast();
                     }
                     break;
+                }
+                // 字符串字面量，ss 中是左引号和转义后的内容
+                // 支持 \\ \' \" \n \r \t 和 \xhh，不能跨行
+                case STRING_LITERAL_STATE: {
+                    if(!current_char.has_value() || current_char.value() == '\n')
+                        return std::make_pair(std::optional<Token>(), std::make_optional<CompilationError>(pos, ErrorCode::ErrInvalidStringLiteral));
+                    auto ch = current_char.value();
+                    if(ch == '"')
+                    {
+                        std::string str = ss.str().substr(1);
+                        return std::make_pair(std::make_optional<Token>(TokenType::STRING_LITERAL, str, pos, currentPos()), std::optional<CompilationError>());
+                    }
+                    if(ch != '\\')
+                    {
+                        if(!miniplc0::isprint(ch))
+                            return std::make_pair(std::optional<Token>(), std::make_optional<CompilationError>(pos, ErrorCode::ErrInvalidStringLiteral));
+                        ss << ch;
+                        break;
+                    }
+                    current_char = nextChar();
+                    if(!current_char.has_value())
+                        return std::make_pair(std::optional<Token>(), std::make_optional<CompilationError>(pos, ErrorCode::ErrInvalidStringLiteral));
+                    switch(current_char.value())
+                    {
+                        case '\\':
+                        case '\'':
+                        case '"':
+                            ss << current_char.value();
+                            break;
+                        case 'n':
+                            ss << '\n';
+                            break;
+                        case 'r':
+                            ss << '\r';
+                            break;
+                        case 't':
+                            ss << '\t';
+                            break;
+                        case 'x': {
+                            //恰好两位十六进制数
+                            int value = 0;
+                            for(int i = 0; i < 2; i++)
+                            {
+                                current_char = nextChar();
+                                if(!current_char.has_value() || !std::isxdigit(static_cast<unsigned char>(current_char.value())))
+                                    return std::make_pair(std::optional<Token>(), std::make_optional<CompilationError>(pos, ErrorCode::ErrInvalidStringLiteral));
+                                auto digit = current_char.value();
+                                value = value * 16 + (miniplc0::isdigit(digit) ? digit - '0' : std::tolower(digit) - 'a' + 10);
+                            }
+                            ss << static_cast<char>(value);
+                            break;
+                        }
+                        default:
+                            return std::make_pair(std::optional<Token>(), std::make_optional<CompilationError>(pos, ErrorCode::ErrInvalidStringLiteral));
+                    }
+                    break;
                 }
                     // 预料之外的状态，如果执行到了这里，说明程序异常
                 default:
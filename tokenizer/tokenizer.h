@@ -35,12 +35,14 @@ namespace miniplc0 {
 			NOTEQUAL_SIGN_STATE,
 			COMMA_STATE,
 			SEMICOLON_STATE,
+			COLON_STATE,
 			LEFTBRACKET_STATE,
 			RIGHTBRACKET_STATE,
 			LEFTBRACE_STATE,
 			RIGHTBRACE_STATE,
 			SINGLE_COMMENT_STATE,
-			MULTI_COMMENT_STATE
+			MULTI_COMMENT_STATE,
+			STRING_LITERAL_STATE
 		};
 	public:
 		Tokenizer(std::istream& ifs)
@@ -0,0 +1,62 @@
+#include "argparse.hpp"
+#include "fmt/core.h"
+
+#include "vm/vm.h"
+#include "fmts.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+// o0 的参考解释器：c0vm [--stat] file.o0，程序从标准输入读取，向标准输出打印
+int main(int argc, char** argv) {
+	argparse::ArgumentParser program("c0vm");
+	program.add_argument("input")
+		.help("specify the o0 file (version 1, 2 or 3) to be executed.");
+	program.add_argument("--stat")
+		.default_value(false)
+		.implicit_value(true)
+		.help("print the executed instructions (dispatches) and the max stack depth to stderr.");
+
+	try {
+		program.parse_args(argc, argv);
+	}
+	catch (const std::runtime_error& err) {
+		fmt::print(stderr, "{}\n\n", err.what());
+		program.print_help();
+		exit(2);
+	}
+
+	auto input_file = program.get<std::string>("input");
+	std::ifstream inf(input_file, std::ios::in | std::ios::binary);
+	if (!inf) {
+		fmt::print(stderr, "Fail to open {} for reading.\n", input_file);
+		exit(2);
+	}
+	miniplc0::Module module;
+	auto err = miniplc0::ReadModule(inf, module);
+	if (err.has_value()) {
+		fmt::print(stderr, "Load error: {}\n", err.value());
+		exit(2);
+	}
+
+	miniplc0::VirtualMachine vm(module);
+	err = vm.Run(std::cin, std::cout);
+	std::cout.flush();
+	if (program["--stat"] == true) {
+		fmt::print(stderr, "version {}: steps {}, max stack {}\n", module._version, vm.GetSteps(), vm.GetMaxStack());
+		//按执行次数从多到少列出每种指令
+		std::vector<std::pair<std::uint64_t, std::uint32_t>> counts;
+		for (std::uint32_t i = 0; i < vm.GetCounts().size(); i++)
+			if (vm.GetCounts().at(i) != 0)
+				counts.emplace_back(vm.GetCounts().at(i), i);
+		std::sort(counts.rbegin(), counts.rend());
+		for (auto& it : counts)
+			fmt::print(stderr, "{} {}\n", (miniplc0::Operation)it.second, it.first);
+	}
+	if (err.has_value()) {
+		fmt::print(stderr, "Runtime error: {}\n", err.value());
+		exit(2);
+	}
+	return 0;
+}
@@ -0,0 +1,437 @@
+#include "vm.h"
+
+#include <climits>
+
+namespace miniplc0 {
+
+    //o0 中的整数都是大端序
+    class ModuleReader final {
+    public:
+        explicit ModuleReader(std::istream& input) : _input(input) {}
+
+        bool read(std::size_t bytes, std::uint32_t& value) {
+            value = 0;
+            for (std::size_t i = 0; i < bytes; i++) {
+                char c;
+                if (!_input.get(c))
+                    return false;
+                value = (value << 8) | (std::uint8_t)c;
+            }
+            return true;
+        }
+
+        bool readString(std::size_t length, std::string& value) {
+            value.resize(length);
+            return length == 0 || (bool)_input.read(&value[0], length);
+        }
+
+    private:
+        std::istream& _input;
+    };
+
+    static std::optional<std::string> readCode(ModuleReader& reader, std::uint32_t version, std::vector<Instruction>& code) {
+        std::uint32_t count;
+        if (!reader.read(2, count))
+            return "unexpected end of file";
+        code.clear();
+        for (std::uint32_t i = 0; i < count; i++) {
+            std::uint32_t opcode;
+            if (!reader.read(1, opcode))
+                return "unexpected end of file";
+            auto opr = (Operation)opcode;
+            //本编译器不会生成浮点、数组等指令，参考解释器也不支持
+            if (!isIntegerOperation(opr) || (version < 2 && isSuperinstruction(opr)))
+                return "unsupported opcode " + std::to_string(opcode);
+            auto sizes = operandSizes(opr);
+            std::uint32_t x = 0, y = 0;
+            if (!reader.read(sizes.first, x) || !reader.read(sizes.second, y))
+                return "unexpected end of file";
+            //1 字节的操作数按有符号数扩展
+            if (sizes.first == 1)
+                x = (std::uint32_t)(std::int32_t)(std::int8_t)x;
+            code.emplace_back(opr, (std::int32_t)x, (std::int32_t)y);
+        }
+        return {};
+    }
+
+    //跳转目标等于代码长度时执行到函数末尾，在运行时报错
+    static std::optional<std::string> checkCode(const Module& module, const std::vector<Instruction>& code) {
+        for (auto& it : code) {
+            auto opr = it.GetOperation();
+            if (isJump(opr) && (it.GetX() < 0 || it.GetX() > (std::int32_t)code.size()))
+                return "jump target out of range";
+            if (opr == Operation::CALL && (it.GetX() < 0 || it.GetX() >= (std::int32_t)module._functions.size()))
+                return "function index out of range";
+            if (opr == Operation::LOADC && (it.GetX() < 0 || it.GetX() >= (std::int32_t)module._constants.size()))
+                return "constant index out of range";
+            if ((opr == Operation::POPN || opr == Operation::SNEW) && it.GetX() < 0)
+                return "negative operand";
+        }
+        return {};
+    }
+
+    std::optional<std::string> ReadModule(std::istream& input, Module& module) {
+        ModuleReader reader(input);
+        std::uint32_t magic;
+        if (!reader.read(4, magic) || magic != 0x43303a29)
+            return "not an o0 file";
+        if (!reader.read(4, module._version) || module._version < 1 || module._version > 3)
+            return "unsupported version";
+
+        std::uint32_t count;
+        if (!reader.read(2, count))
+            return "unexpected end of file";
+        module._constants.clear();
+        for (std::uint32_t i = 0; i < count; i++) {
+            std::uint32_t type, length;
+            std::string value;
+            if (!reader.read(1, type) || !reader.read(2, length) || !reader.readString(length, value))
+                return "unexpected end of file";
+            if (type != 0)
+                return "unsupported constant type " + std::to_string(type);
+            module._constants.emplace_back(value);
+        }
+
+        module._data.clear();
+        if (module._version >= 3) {
+            if (!reader.read(2, count))
+                return "unexpected end of file";
+            for (std::uint32_t i = 0; i < count; i++) {
+                std::uint32_t value;
+                if (!reader.read(4, value))
+                    return "unexpected end of file";
+                module._data.emplace_back((std::int32_t)value);
+            }
+        }
+
+        auto err = readCode(reader, module._version, module._start);
+        if (err.has_value())
+            return err;
+
+        if (!reader.read(2, count))
+            return "unexpected end of file";
+        module._functions.clear();
+        for (std::uint32_t i = 0; i < count; i++) {
+            std::uint32_t name, params, level;
+            if (!reader.read(2, name) || !reader.read(2, params) || !reader.read(2, level))
+                return "unexpected end of file";
+            if (name >= module._constants.size())
+                return "function name index out of range";
+            ModuleFunction function;
+            function._name_index = name;
+            function._params = params;
+            function._level = level;
+            err = readCode(reader, module._version, function._instruction);
+            if (err.has_value())
+                return err;
+            module._functions.emplace_back(std::move(function));
+        }
+
+        err = checkCode(module, module._start);
+        for (size_t i = 0; i < module._functions.size() && !err.has_value(); i++)
+            err = checkCode(module, module._functions.at(i)._instruction);
+        return err;
+    }
+
+    std::optional<std::string> VirtualMachine::Run(std::istream& input, std::ostream& output) {
+        //栈的槽数的上限
+        const size_t limit = (size_t)1 << 24;
+        struct Frame {
+            const std::vector<Instruction>* _code;
+            size_t _pc;
+            size_t _bp;
+            int32_t _function;
+        };
+
+        int32_t main = -1;
+        for (size_t i = 0; i < _module._functions.size(); i++)
+            if (_module._constants.at(_module._functions.at(i)._name_index) == "main")
+                main = i;
+        if (main < 0)
+            return "no main function";
+
+        //数据段整块复制到启动代码的栈帧
+        _stack.assign(_module._data.begin(), _module._data.end());
+        _steps = 0;
+        _max_stack = _stack.size();
+        _counts.assign(256, 0);
+        _written = 0;
+        _snapshot.reset();
+        std::vector<Frame> frames;
+        Frame frame = {&_module._start, 0, 0, -1};
+        bool started = false;
+
+        auto where = [&]() {
+            auto name = frame._function < 0 ? std::string(".start")
+                : _module._constants.at(_module._functions.at(frame._function)._name_index);
+            return " at instruction " + std::to_string(frame._pc - 1) + " of " + name;
+        };
+        auto call = [&](int32_t function) {
+            frames.emplace_back(frame);
+            auto& callee = _module._functions.at(function);
+            frame = {&callee._instruction, 0, _stack.size() - callee._params, function};
+        };
+        auto pop = [&]() {
+            int32_t value = _stack.back();
+            _stack.pop_back();
+            return value;
+        };
+        auto wrap = [](int64_t value) { return (int32_t)(uint32_t)value; };
+        auto taken = [](Operation opr, int32_t value) {
+            switch (opr) {
+                case Operation::JE: case Operation::IJE: return value == 0;
+                case Operation::JNE: case Operation::IJNE: return value != 0;
+                case Operation::JL: case Operation::IJL: return value < 0;
+                case Operation::JGE: case Operation::IJGE: return value >= 0;
+                case Operation::JG: case Operation::IJG: return value > 0;
+                default: return value <= 0;
+            }
+        };
+
+        while (true) {
+            auto& code = *frame._code;
+            if (frame._pc >= code.size()) {
+                if (started || frame._function >= 0)
+                    return "execution falls off the end" + where();
+                //启动代码执行完后调用 main
+                started = true;
+                if (_module._functions.at(main)._params != 0)
+                    return std::string("main can not have parameters");
+                call(main);
+                continue;
+            }
+            if (frame._function == main && frames.size() == 1 && frame._pc < _points.size() && _points[frame._pc]
+                && _written <= _output_limit) {
+                //复用已有的缓冲区，避免每条指令都分配内存
+                if (!_snapshot.has_value())
+                    _snapshot = Snapshot();
+                _snapshot->_pc = frame._pc;
+                _snapshot->_stack.assign(_stack.begin(), _stack.end());
+                _snapshot->_output = _written;
+                _snapshot->_steps = _steps;
+            }
+            if (_step_limit != 0 && _steps >= _step_limit)
+                return "step limit exceeded" + where();
+            auto& it = code[frame._pc++];
+            auto opr = it.GetOperation();
+            _steps++;
+            _counts[(uint32_t)opr]++;
+
+            //执行前检查操作数栈中当前栈帧的部分是否足够
+            size_t needed = 0;
+            switch (opr) {
+                case Operation::POP: case Operation::DUP: case Operation::ILOAD: case Operation::INEG:
+                case Operation::JE: case Operation::JNE: case Operation::JL: case Operation::JGE: case Operation::JG: case Operation::JLE:
+                case Operation::IRET: case Operation::IPRINT: case Operation::CPRINT: case Operation::SPRINT:
+                case Operation::ISTOREL: case Operation::ISTOREG: case Operation::IADDI:
+                    needed = 1;
+                    break;
+                case Operation::POP2: case Operation::DUP2: case Operation::ISTORE:
+                case Operation::IADD: case Operation::ISUB: case Operation::IMUL: case Operation::IDIV: case Operation::ICMP:
+                case Operation::IJE: case Operation::IJNE: case Operation::IJL: case Operation::IJGE: case Operation::IJG: case Operation::IJLE:
+                    needed = 2;
+                    break;
+                case Operation::POPN:
+                    needed = it.GetX();
+                    break;
+                case Operation::CALL:
+                    needed = _module._functions.at(it.GetX())._params;
+                    break;
+                default:
+                    break;
+            }
+            if (_stack.size() < frame._bp + needed)
+                return "stack underflow" + where();
+
+            auto address = [&](int32_t level, int64_t offset, int64_t& result) {
+                //所有函数的层次都是 1，上一层就是启动代码的栈帧
+                int64_t base;
+                if (level == 0)
+                    base = frame._bp;
+                else if (level == 1 && frame._function >= 0)
+                    base = 0;
+                else
+                    return false;
+                result = base + offset;
+                return result >= 0 && result < (int64_t)_stack.size();
+            };
+
+            int64_t at;
+            switch (opr) {
+                case Operation::NOP:
+                    break;
+                case Operation::BIPUSH:
+                case Operation::IPUSH:
+                case Operation::LOADC:
+                    _stack.push_back(it.GetX());
+                    break;
+                case Operation::POP:
+                    _stack.pop_back();
+                    break;
+                case Operation::POP2:
+                    _stack.resize(_stack.size() - 2);
+                    break;
+                case Operation::POPN:
+                    _stack.resize(_stack.size() - it.GetX());
+                    break;
+                case Operation::DUP:
+                    _stack.push_back(_stack.back());
+                    break;
+                case Operation::DUP2: {
+                    int32_t a = _stack.at(_stack.size() - 2), b = _stack.back();
+                    _stack.push_back(a);
+                    _stack.push_back(b);
+                    break;
+                }
+                case Operation::LOADA:
+                    //地址可以指向当前的栈顶之上，在 ILOAD/ISTORE 时检查
+                    if (it.GetX() == 0)
+                        at = (int64_t)frame._bp + it.GetY();
+                    else if (it.GetX() == 1 && frame._function >= 0)
+                        at = it.GetY();
+                    else
+                        return "invalid level" + where();
+                    if (at < 0 || at > INT_MAX)
+                        return "invalid address" + where();
+                    _stack.push_back((int32_t)at);
+                    break;
+                case Operation::SNEW:
+                    _stack.resize(_stack.size() + it.GetX(), 0);
+                    break;
+                case Operation::ILOAD: {
+                    int32_t a = pop();
+                    if (a < 0 || (size_t)a >= _stack.size())
+                        return "invalid address" + where();
+                    _stack.push_back(_stack.at(a));
+                    break;
+                }
+                case Operation::ISTORE: {
+                    int32_t value = pop(), a = pop();
+                    if (a < 0 || (size_t)a >= _stack.size())
+                        return "invalid address" + where();
+                    _stack.at(a) = value;
+                    break;
+                }
+                case Operation::ILOADL:
+                case Operation::ILOADG:
+                    if (!address(opr == Operation::ILOADL ? 0 : 1, it.GetX(), at))
+                        return "invalid address" + where();
+                    _stack.push_back(_stack.at(at));
+                    break;
+                case Operation::ISTOREL:
+                case Operation::ISTOREG: {
+                    int32_t value = pop();
+                    if (!address(opr == Operation::ISTOREL ? 0 : 1, it.GetX(), at))
+                        return "invalid address" + where();
+                    _stack.at(at) = value;
+                    break;
+                }
+                case Operation::IADD:
+                case Operation::ISUB:
+                case Operation::IMUL:
+                case Operation::IDIV:
+                case Operation::ICMP: {
+                    int64_t b = pop(), a = pop();
+                    int32_t result;
+                    if (opr == Operation::IADD)
+                        result = wrap(a + b);
+                    else if (opr == Operation::ISUB)
+                        result = wrap(a - b);
+                    else if (opr == Operation::IMUL)
+                        result = wrap(a * b);
+                    else if (opr == Operation::ICMP)
+                        result = (a > b) - (a < b);
+                    else if (b == 0)
+                        return "division by zero" + where();
+                    else
+                        result = wrap(a / b);
+                    _stack.push_back(result);
+                    break;
+                }
+                case Operation::IADDI:
+                    _stack.back() = wrap((int64_t)_stack.back() + it.GetX());
+                    break;
+                case Operation::INEG:
+                    _stack.back() = wrap(-(int64_t)_stack.back());
+                    break;
+                case Operation::JMP:
+                    frame._pc = it.GetX();
+                    break;
+                case Operation::JE:
+                case Operation::JNE:
+                case Operation::JL:
+                case Operation::JGE:
+                case Operation::JG:
+                case Operation::JLE:
+                    if (taken(opr, pop()))
+                        frame._pc = it.GetX();
+                    break;
+                case Operation::IJE:
+                case Operation::IJNE:
+                case Operation::IJL:
+                case Operation::IJGE:
+                case Operation::IJG:
+                case Operation::IJLE: {
+                    int64_t b = pop(), a = pop();
+                    if (taken(opr, wrap(a - b)))
+                        frame._pc = it.GetX();
+                    break;
+                }
+                case Operation::CALL:
+                    call(it.GetX());
+                    break;
+                case Operation::RET:
+                case Operation::IRET: {
+                    if (frames.empty())
+                        return "return from the start code" + where();
+                    int32_t value = opr == Operation::IRET ? pop() : 0;
+                    _stack.resize(frame._bp);
+                    if (opr == Operation::IRET)
+                        _stack.push_back(value);
+                    frame = frames.back();
+                    frames.pop_back();
+                    //main 返回，程序结束
+                    if (frames.empty())
+                        return {};
+                    break;
+                }
+                case Operation::IPRINT: {
+                    auto text = std::to_string(pop());
+                    output << text;
+                    _written += text.size();
+                    break;
+                }
+                case Operation::CPRINT:
+                    output.put((char)pop());
+                    _written++;
+                    break;
+                case Operation::SPRINT: {
+                    int32_t constant = pop();
+                    if (constant < 0 || (size_t)constant >= _module._constants.size())
+                        return "invalid constant" + where();
+                    output << _module._constants.at(constant);
+                    _written += _module._constants.at(constant).size();
+                    break;
+                }
+                case Operation::PRINTL:
+                    output << '\n';
+                    _written++;
+                    break;
+                case Operation::ISCAN: {
+                    int64_t value;
+                    if (!(input >> value) || value < INT_MIN || value > INT_MAX)
+                        return "invalid input" + where();
+                    _stack.push_back((int32_t)value);
+                    break;
+                }
+                default:
+                    return "unsupported instruction" + where();
+            }
+            if (_stack.size() > _max_stack) {
+                _max_stack = _stack.size();
+                if (_max_stack > limit)
+                    return "stack overflow" + where();
+            }
+        }
+    }
+}
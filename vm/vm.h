@@ -0,0 +1,92 @@
+#pragma once
+
+#include "instruction/instruction.h"
+
+#include <vector>
+#include <string>
+#include <optional>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstddef> // for std::size_t
+
+namespace miniplc0 {
+
+    // o0 文件中的一个函数
+    struct ModuleFunction {
+        std::int32_t _name_index;
+        std::int32_t _params;
+        std::int32_t _level;
+        std::vector<Instruction> _instruction;
+    };
+
+    // o0 文件的内容
+    struct Module {
+        std::uint32_t _version;
+        std::vector<std::string> _constants;
+        // 第 3 版的数据段，执行启动代码之前依次压入栈
+        std::vector<std::int32_t> _data;
+        std::vector<Instruction> _start;
+        std::vector<ModuleFunction> _functions;
+    };
+
+    // 读取第 1 至 3 版的 o0 文件并检查操作数，出错时返回错误信息
+    // 函数之后的字节（--max-stack 的扩展字段）被忽略
+    std::optional<std::string> ReadModule(std::istream&, Module&);
+
+    // main 的栈帧中执行某条指令之前的状态
+    struct Snapshot {
+        // main 中的指令下标
+        std::size_t _pc;
+        // 整个操作数栈，前面是启动代码的栈帧
+        std::vector<std::int32_t> _stack;
+        // 此前输出的字节数
+        std::size_t _output;
+        std::uint64_t _steps;
+    };
+
+    // o0 的参考解释器，用来比较不同版本的指令的分派次数，也用于编译时执行
+    class VirtualMachine final {
+    private:
+        using int32_t = std::int32_t;
+        using uint64_t = std::uint64_t;
+        using size_t = std::size_t;
+    public:
+        explicit VirtualMachine(const Module& module)
+            : _module(module), _stack({}), _steps(0), _max_stack(0), _counts(256, 0), _step_limit(0), _written(0),
+            _points({}), _output_limit(0), _snapshot() {}
+        VirtualMachine(VirtualMachine&&) = delete;
+        VirtualMachine(const VirtualMachine&) = delete;
+        VirtualMachine& operator=(VirtualMachine) = delete;
+
+        // 执行启动代码，然后调用 main 直到它返回，出错时返回错误信息
+        std::optional<std::string> Run(std::istream& input, std::ostream& output);
+
+        // 执行的指令数，也就是分派的次数
+        uint64_t GetSteps() const { return _steps; }
+        // 栈的最大高度
+        size_t GetMaxStack() const { return _max_stack; }
+        // 每种操作码执行的次数，以操作码为下标
+        const std::vector<uint64_t>& GetCounts() const { return _counts; }
+
+        // 执行的指令数的上限，超过时报错，0 为不限制
+        void SetStepLimit(uint64_t limit) { _step_limit = limit; }
+        // 在 main 的栈帧中执行 points[pc] 为真的指令之前，如果输出不超过 limit 字节，记录当时的状态
+        void SetSnapshotPoints(std::vector<bool> points, size_t limit) { _points = std::move(points); _output_limit = limit; }
+        // 最后记录的状态
+        const std::optional<Snapshot>& GetSnapshot() const { return _snapshot; }
+
+    private:
+        const Module& _module;
+        std::vector<int32_t> _stack;
+        uint64_t _steps;
+        size_t _max_stack;
+        std::vector<uint64_t> _counts;
+        uint64_t _step_limit;
+        // 已经输出的字节数
+        size_t _written;
+        std::vector<bool> _points;
+        size_t _output_limit;
+        std::optional<Snapshot> _snapshot;
+    };
+}